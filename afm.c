@@ -5,96 +5,294 @@
 #include <string.h>
 #include "mkfn.h"
 
-#define TOKLEN		256
+/* read the whole input */
+static char *afm_input(void)
+{
+	struct sbuf *sb = sbuf_make();
+	char buf[1 << 14];
+	long nr;
+	while ((nr = fread(buf, 1, sizeof(buf), stdin)) > 0)
+		sbuf_mem(sb, buf, nr);
+	return sbuf_done(sb);
+}
 
-static char *afm_charfield(char *s, char *d)
+/* terminate the line starting at s; return the next line */
+static char *afm_line(char *s)
 {
-	while (*s && !isspace(*s) && *s != ';')
-		*d++ = *s++;
-	while (isspace(*s) || *s == ';')
-		s++;
-	*d = '\0';
-	return s;
+	char *e = strchr(s, '\n');
+	if (!e)
+		return s + strlen(s);
+	*e = '\0';
+	return e + 1;
 }
 
-static int uwid(int w)
+#define afm_space(c)	((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == ';')
+
+/* return the next token of the line, terminated in place */
+static char *afm_tok(char **s)
 {
-	long div = 72000 / mkfn_res;
-	return (w < 0 ? w - div / 20 : w + div / 20) * (long) 10 / div;
+	char *r = *s;
+	char *tok;
+	while (afm_space(*r))
+		r++;
+	tok = r;
+	while (*r && !afm_space(*r))
+		r++;
+	*s = *r ? r + 1 : r;
+	*r = '\0';
+	return tok;
 }
-int afm_read(void)
+
+/* parse an integer; the fractional part is ignored */
+static int afm_int(char **s)
 {
-	char ln[1024];
-	char ch[TOKLEN] = "", pos[TOKLEN] = "";
-	char c1[TOKLEN] = "", c2[TOKLEN] = "";
-	char wid[TOKLEN] = "", field[TOKLEN] = "";
-	char llx[TOKLEN] = "0", lly[TOKLEN] = "0";
-	char urx[TOKLEN] = "0", ury[TOKLEN] = "0";
-	char fontname[128];
-	char *s;
-	while (fgets(ln, sizeof(ln), stdin)) {
-		if (ln[0] == '#')
-			continue;
-		if (!strncmp("FontName ", ln, 8)) {
-			sscanf(ln, "FontName %s", fontname);
-			continue;
-		}
-		if (!strncmp("StartCharMetrics", ln, 16))
-			break;
+	char *r = *s;
+	int neg, n = 0;
+	while (afm_space(*r))
+		r++;
+	neg = *r == '-';
+	if (*r == '-' || *r == '+')
+		r++;
+	while (*r >= '0' && *r <= '9') {
+		if (n < 100000000)
+			n = n * 10 + *r - '0';
+		r++;
 	}
-	while (fgets(ln, sizeof(ln), stdin)) {
-		if (ln[0] == '#')
-			continue;
-		if (!strncmp("EndCharMetrics", ln, 14))
-			break;
-		s = ln;
-		while (*s) {
-			s = afm_charfield(s, field);
-			if (!strcmp("C", field)) {
-				s = afm_charfield(s, pos);
-				continue;
-			}
-			if (!strcmp("WX", field)) {
-				s = afm_charfield(s, wid);
-				continue;
-			}
-			if (!strcmp("N", field)) {
-				s = afm_charfield(s, ch);
-				continue;
-			}
-			if (!strcmp("B", field)) {
-				s = afm_charfield(s, llx);
-				s = afm_charfield(s, lly);
-				s = afm_charfield(s, urx);
-				s = afm_charfield(s, ury);
-				continue;
-			}
-			if (!strcmp("L", field)) {
-				s = afm_charfield(s, c1);
-				s = afm_charfield(s, c2);
-				continue;
+	while (*r && !afm_space(*r))
+		r++;
+	*s = r;
+	return neg ? -n : n;
+}
+
+/* terminate the field starting at s; return the next field */
+static char *afm_field(char *s)
+{
+	char *e = strchr(s, ';');
+	if (!e)
+		return s + strlen(s);
+	*e = '\0';
+	return e + 1;
+}
+
+/* parse a hexadecimal code: <20AC> */
+static int afm_hex(char *s)
+{
+	long n = strtol(s + (*s == '<'), NULL, 16);
+	return n >= 0 && n < (1 << 24) ? n : -1;
+}
+
+/* character metrics, for composite characters */
+struct afmchar {
+	char *name;
+	int wid;
+	int bbox[4];
+};
+
+static struct afmchar *afm_chars;	/* characters */
+static int afm_n;			/* number of characters */
+static struct tab *afm_tab;		/* character names to afm_chars */
+static int afm_cid;			/* a CID-keyed font */
+
+/* a line of character metrics: C 32 ; WX 250 ; N space ; B 0 0 0 0 ; */
+static void afm_char(char *s)
+{
+	char cid[16];
+	char *fld, *tok, *name = NULL;
+	int pos = 0, wid = 0, code = -1;
+	int llx = 0, lly = 0, urx = 0, ury = 0;
+	int haspos = 0, haswid = 0;
+	/* fields are separated by semicolons; unknown fields are skipped */
+	while (*s) {
+		fld = s;
+		s = afm_field(s);
+		while (*(tok = afm_tok(&fld))) {
+			switch (tok[0]) {
+			case 'C':
+				if (!tok[1]) {
+					pos = afm_int(&fld);
+					haspos = 1;
+					continue;
+				}
+				if (tok[1] == 'H' && !tok[2]) {
+					code = afm_hex(afm_tok(&fld));
+					pos = code < 256 ? code : -1;
+					haspos = code >= 0;
+					continue;
+				}
+				break;
+			case 'W':
+				if (!strcmp("WX", tok) || !strcmp("W0X", tok)) {
+					wid = afm_int(&fld);
+					haswid = 1;
+					continue;
+				}
+				break;
+			case 'N':
+				if (!tok[1]) {
+					name = afm_tok(&fld);
+					continue;
+				}
+				break;
+			case 'B':
+				if (!tok[1]) {
+					llx = afm_int(&fld);
+					lly = afm_int(&fld);
+					urx = afm_int(&fld);
+					ury = afm_int(&fld);
+					continue;
+				}
+				break;
 			}
 			break;
 		}
-		if (ch[0] && pos[0] && wid[0])
-			mkfn_char(ch, atoi(pos), 0, uwid(atoi(wid)),
-				uwid(atoi(llx)), uwid(atoi(lly)),
-				uwid(atoi(urx)), uwid(atoi(ury)));
 	}
-	mkfn_header(fontname);
-	while (fgets(ln, sizeof(ln), stdin)) {
-		if (ln[0] == '#')
-			continue;
-		if (!strncmp("StartKernPairs", ln, 14))
+	/* CID-keyed fonts: N is the CID, or else the code is */
+	if (afm_cid && (!name || !name[0]) && (code >= 0 || pos >= 0)) {
+		sprintf(cid, "%d", code >= 0 ? code : pos);
+		name = cid;
+	}
+	if (!name || !name[0] || !haspos || !haswid)
+		return;
+	mkfn_char(name, afm_cid ? -1 : pos,
+		afm_cid && isdigit((unsigned char) name[0]) ?
+			mkfn_cidcode(atoi(name)) : 0,
+		mkfn_uwid(wid), mkfn_uwid(llx), mkfn_uwid(lly),
+		mkfn_uwid(urx), mkfn_uwid(ury));
+	if (name != cid && !tab_get(afm_tab, name)) {
+		afm_chars[afm_n].name = name;
+		afm_chars[afm_n].wid = wid;
+		afm_chars[afm_n].bbox[0] = llx;
+		afm_chars[afm_n].bbox[1] = lly;
+		afm_chars[afm_n].bbox[2] = urx;
+		afm_chars[afm_n].bbox[3] = ury;
+		tab_put(afm_tab, name, &afm_chars[afm_n++]);
+	}
+}
+
+/* composite characters missing from the font: CC Aacute 2 ; PCC A 0 0 ; PCC acute 194 214 ; */
+static void afm_composites(char *s)
+{
+	struct afmchar *c;
+	char *ln, *tok, *name;
+	int wid = 0, bbox[4] = {0};
+	int n, i, dx, dy;
+	while (*s) {
+		ln = s;
+		s = afm_line(s);
+		tok = afm_tok(&ln);
+		if (!strcmp("EndComposites", tok))
 			break;
+		if (strcmp("CC", tok))
+			continue;
+		name = afm_tok(&ln);
+		n = afm_int(&ln);
+		if (!name[0] || tab_get(afm_tab, name))
+			continue;
+		for (i = 0; i < n; i++) {
+			if (strcmp("PCC", afm_tok(&ln)))
+				break;
+			c = tab_get(afm_tab, afm_tok(&ln));
+			dx = afm_int(&ln);
+			dy = afm_int(&ln);
+			if (!c)
+				break;
+			if (!i || c->bbox[0] + dx < bbox[0])
+				bbox[0] = c->bbox[0] + dx;
+			if (!i || c->bbox[1] + dy < bbox[1])
+				bbox[1] = c->bbox[1] + dy;
+			if (!i || c->bbox[2] + dx > bbox[2])
+				bbox[2] = c->bbox[2] + dx;
+			if (!i || c->bbox[3] + dy > bbox[3])
+				bbox[3] = c->bbox[3] + dy;
+			if (!i)
+				wid = c->wid;
+		}
+		if (n > 0 && i == n)
+			mkfn_char(name, -1, 0, mkfn_uwid(wid),
+				mkfn_uwid(bbox[0]), mkfn_uwid(bbox[1]),
+				mkfn_uwid(bbox[2]), mkfn_uwid(bbox[3]));
 	}
-	while (fgets(ln, sizeof(ln), stdin)) {
+}
+
+/* a kerning pair: KPX c1 c2 x or KP c1 c2 x y */
+static void afm_kern(char *s)
+{
+	char *c1 = afm_tok(&s);
+	char *c2 = afm_tok(&s);
+	int x = afm_int(&s);
+	if (c1[0] && c2[0])
+		mkfn_kern(c1, c2, mkfn_uwid(x));
+}
+
+int afm_read(void)
+{
+	char fontname[128] = "";
+	char *buf = afm_input();
+	char *s = buf;
+	char *ln, *tok, *cc, *ce;
+	char *comp;		/* a copy of the composites section */
+	int chars = 0;		/* in char metrics section */
+	int kerns = 0;		/* in kern pairs section */
+	int header = 0;		/* mkfn_header() is called */
+	int n = 1;
+	for (ln = buf; (ln = strchr(ln, '\n')) != NULL; ln++)
+		n++;
+	afm_chars = malloc(n * sizeof(afm_chars[0]));
+	afm_tab = tab_alloc(n);
+	while (*s) {
+		ln = s;
+		s = afm_line(s);
 		if (ln[0] == '#')
 			continue;
-		if (!strncmp("EndKernPairs", ln, 12))
+		if (chars && strncmp("EndCharMetrics", ln, 14)) {
+			afm_char(ln);
+			continue;
+		}
+		tok = afm_tok(&ln);
+		switch (tok[0]) {
+		case 'E':
+			if (!strcmp("EndCharMetrics", tok)) {
+				chars = 0;
+				/* composites follow; they are parsed in a copy */
+				if ((cc = strstr(s, "StartComposites")) != NULL) {
+					if ((ce = strstr(cc, "EndComposites")) == NULL)
+						ce = cc + strlen(cc);
+					comp = malloc(ce - cc + 1);
+					memcpy(comp, cc, ce - cc);
+					comp[ce - cc] = '\0';
+					afm_composites(comp);
+					free(comp);
+				}
+				mkfn_header(fontname);
+				header = 1;
+			}
+			if (!strcmp("EndKernPairs", tok))
+				kerns = 0;
+			break;
+		case 'F':
+			if (!strcmp("FontName", tok) && !header)
+				snprintf(fontname, sizeof(fontname), "%s", afm_tok(&ln));
+			break;
+		case 'I':
+			if (!strcmp("IsCIDFont", tok))
+				afm_cid = !strcmp("true", afm_tok(&ln));
 			break;
-		if (sscanf(ln, "KPX %s %s %s", c1, c2, wid) == 3)
-			mkfn_kern(c1, c2, uwid(atoi(wid)));
+		case 'K':
+			if (kerns && (!strcmp("KPX", tok) || !strcmp("KP", tok)))
+				afm_kern(ln);
+			break;
+		case 'S':
+			if (!strcmp("StartCharMetrics", tok) && !header)
+				chars = 1;
+			if (!strncmp("StartKernPairs", tok, 14) && header)
+				kerns = 1;
+			break;
+		}
 	}
+	if (!header)
+		mkfn_header(fontname);
+	tab_free(afm_tab);
+	free(afm_chars);
+	free(buf);
 	return 0;
 }
@@ -0,0 +1,107 @@
+/* the bounding boxes of glyph outlines, for charstring interpreters */
+#include <string.h>
+#include "mkfn.h"
+
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define MAX(a, b)		((a) < (b) ? (b) : (a))
+
+static void bbox_point(struct bbox *bb, double x, double y)
+{
+	if (!bb->n++) {
+		bb->b[0] = bb->b[2] = x;
+		bb->b[1] = bb->b[3] = y;
+	}
+	bb->b[0] = MIN(bb->b[0], x);
+	bb->b[1] = MIN(bb->b[1], y);
+	bb->b[2] = MAX(bb->b[2], x);
+	bb->b[3] = MAX(bb->b[3], y);
+}
+
+static int bbox_inside(struct bbox *bb, double x, double y)
+{
+	return x >= bb->b[0] && x <= bb->b[2] &&
+		y >= bb->b[1] && y <= bb->b[3];
+}
+
+/* include the extrema of a cubic bezier curve, by subdividing it */
+static void bbox_bezier(struct bbox *bb, double *x, double *y, int depth)
+{
+	double lx[4], ly[4], rx[4], ry[4];
+	if (depth > 16 || (bbox_inside(bb, x[1], y[1]) && bbox_inside(bb, x[2], y[2])))
+		return;
+	lx[0] = x[0];
+	ly[0] = y[0];
+	lx[1] = (x[0] + x[1]) / 2;
+	ly[1] = (y[0] + y[1]) / 2;
+	rx[2] = (x[2] + x[3]) / 2;
+	ry[2] = (y[2] + y[3]) / 2;
+	rx[3] = x[3];
+	ry[3] = y[3];
+	rx[1] = (x[1] + x[2]) / 2;
+	ry[1] = (y[1] + y[2]) / 2;
+	lx[2] = (lx[1] + rx[1]) / 2;
+	ly[2] = (ly[1] + ry[1]) / 2;
+	rx[1] = (rx[1] + rx[2]) / 2;
+	ry[1] = (ry[1] + ry[2]) / 2;
+	lx[3] = rx[0] = (lx[2] + rx[1]) / 2;
+	ly[3] = ry[0] = (ly[2] + ry[1]) / 2;
+	bbox_point(bb, lx[3], ly[3]);
+	bbox_bezier(bb, lx, ly, depth + 1);
+	bbox_bezier(bb, rx, ry, depth + 1);
+}
+
+/* a contour is included only if something is drawn from its start */
+static void bbox_draw(struct bbox *bb)
+{
+	if (bb->moved)
+		bbox_point(bb, bb->x, bb->y);
+	bb->moved = 0;
+}
+
+void bbox_move(struct bbox *bb, double x, double y)
+{
+	bb->x = x;
+	bb->y = y;
+	bb->moved = 1;
+}
+
+void bbox_line(struct bbox *bb, double x, double y)
+{
+	bbox_draw(bb);
+	bb->x = x;
+	bb->y = y;
+	bbox_point(bb, x, y);
+}
+
+/* a curve from the current point to (x3, y3), in absolute coordinates */
+void bbox_curve(struct bbox *bb, double x1, double y1,
+		double x2, double y2, double x3, double y3)
+{
+	double x[4], y[4];
+	bbox_draw(bb);
+	x[0] = bb->x;
+	y[0] = bb->y;
+	x[1] = x1;
+	y[1] = y1;
+	x[2] = x2;
+	y[2] = y2;
+	x[3] = x3;
+	y[3] = y3;
+	bbox_point(bb, x[3], y[3]);
+	bbox_bezier(bb, x, y, 0);
+	bb->x = x3;
+	bb->y = y3;
+}
+
+/* the scaled bounding box, rounded outwards; zero if nothing is drawn */
+void bbox_get(struct bbox *bb, double scl, int *box)
+{
+	if (!bb->n) {
+		memset(box, 0, 4 * sizeof(box[0]));
+		return;
+	}
+	box[0] = mkfn_ifloor(bb->b[0] * scl);
+	box[1] = mkfn_ifloor(bb->b[1] * scl);
+	box[2] = -mkfn_ifloor(-bb->b[2] * scl);
+	box[3] = -mkfn_ifloor(-bb->b[3] * scl);
+}
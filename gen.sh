@@ -28,6 +28,13 @@ afmconv() {
 		sed "/^ligatures /s/ $LIGIGN//g" >"$TP/$1"
 }
 
+# t1conv troff_name font_path extra_mktrfn_options
+t1conv() {
+	echo $1
+	cat "$2" | ./mkfn -a -b -r$RES -t$1 -f "$2" $3 $4 $5 $6 $7 | \
+		sed "/^ligatures /s/ $LIGIGN//g" >"$TP/$1"
+}
+
 # ttfconv troff_name font_path extra_mktrfn_options
 ttfconv() {
 	echo $1
@@ -37,14 +44,7 @@ ttfconv() {
 
 # otfconv troff_name font_path extra_mktrfn_options
 otfconv() {
-	TTF="/tmp/.neatmkfn.ttf"
-	if ! command -v fontforge >/dev/null; then
-		echo "Fontforge is needed to convert OTF files to TTF!"
-		return 1
-	fi
-	fontforge -lang=ff -c "Open(\"$2\"); Generate(\"$TTF\");" >/dev/null 2>&1
-	ttfconv "$1" $TTF $3 $4 $5 $6 $7
-	rm $TTF
+	ttfconv "$1" "$2" $3 $4 $5 $6 $7
 }
 
 # stdfont troff_name gs_font urw_font extra_mktrfn_options
@@ -105,6 +105,13 @@ do
 	afmconv `basename "$FN" .afm` "$FN"
 done
 
+# Type 1 fonts without AFM files
+find "$FP/" -name '*.pfa' -o -name '*.pfb' -o -name '*.t1' | while read FN
+do
+	BN="`echo \"$FN\" | sed 's/\.[^.]*$//'`"
+	test -f "$BN.afm" || t1conv `basename "$BN"` "$FN"
+done
+
 find "$FP/" -name '*.ttf' | while read FN
 do
 	ttfconv `basename "$FN" .ttf` "$FN"
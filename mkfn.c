@@ -22,13 +22,16 @@
 #include "mkfn.h"
 
 #define LEN(a)		((sizeof(a) / sizeof((a)[0])))
+#define NCIDS		(1 << 16)
 
 static char *mkfn_scripts;	/* filtered scripts */
 static char *mkfn_langs;	/* filtered languages */
 static char *mkfn_subfont;	/* filtered font */
+static char *mkfn_instname;	/* variable font instance */
 static char *mkfn_trname;	/* font troff name */
 static char *mkfn_psname;	/* font ps name */
 static char *mkfn_path;		/* font path */
+static char *mkfn_cidmap;	/* CID to Unicode mapping file */
 int mkfn_res = 720;		/* device resolution */
 int mkfn_warn;			/* warn about unsupported features */
 int mkfn_kmin;			/* minimum kerning value */
@@ -122,6 +125,82 @@ int mkfn_font(char *font)
 	return !strcmp(mkfn_subfont, font);
 }
 
+/*
+ * return 1 if the given named instance of a variable font is to be used;
+ * if name is NULL, return 1 if a named instance is specified
+ */
+int mkfn_instance(char *name)
+{
+	static int idx;			/* instance index */
+	if (!name)
+		return mkfn_instname && strcmp("list", mkfn_instname) &&
+			!strchr(mkfn_instname, '=');
+	idx++;
+	if (!mkfn_instname)
+		return 0;
+	if (!strcmp("list", mkfn_instname))
+		printf("%s\n", name);
+	if (isdigit((unsigned char) mkfn_instname[0]) && !strchr(mkfn_instname, '='))
+		return atoi(mkfn_instname) == idx;
+	return !strcmp(mkfn_instname, name);
+}
+
+/* return 1 if the coordinate of the given variation axis is specified */
+int mkfn_axis(char *axis, double *val)
+{
+	char *s = mkfn_instname;
+	int len = strlen(axis);
+	while (len && s && (s = strstr(s, axis)) != NULL) {
+		if ((s == mkfn_instname || s[-1] == ',') && s[len] == '=') {
+			*val = atof(s + len + 1);
+			return 1;
+		}
+		s += len;
+	}
+	return 0;
+}
+
+/* convert widths in 1/1000 em to device units */
+int mkfn_uwid(int w)
+{
+	long div = 72000 / mkfn_res;
+	return (w < 0 ? w - div / 20 : w + div / 20) * 10 / div;
+}
+
+/* the floor of d; far out of range values are clamped */
+int mkfn_ifloor(double d)
+{
+	int n = (int) (d < -(1 << 20) ? -(1 << 20) : (d > (1 << 20) ? 1 << 20 : d));
+	return n > d ? n - 1 : n;
+}
+
+/* return the codepoint of the given CID, as specified in the -u file */
+int mkfn_cidcode(int cid)
+{
+	static int *codes;
+	char ln[256];
+	char *s;
+	FILE *fp;
+	int c;
+	if (!codes && mkfn_cidmap && (fp = fopen(mkfn_cidmap, "r")) != NULL) {
+		codes = calloc(NCIDS, sizeof(codes[0]));
+		/* lines of a decimal CID and a hexadecimal codepoint */
+		while (fgets(ln, sizeof(ln), fp)) {
+			if (!isdigit((unsigned char) ln[0]))
+				continue;
+			c = strtol(ln, &s, 10);
+			while (*s && !isxdigit((unsigned char) *s))
+				s++;
+			if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+				s += 2;
+			if (c >= 0 && c < NCIDS && !codes[c])
+				codes[c] = strtol(s, NULL, 16);
+		}
+		fclose(fp);
+	}
+	return codes && cid >= 0 && cid < NCIDS ? codes[cid] : 0;
+}
+
 /* return the rank of the given feature, for the current script */
 int mkfn_featrank(char *scrp, char *feat)
 {
@@ -158,12 +237,22 @@ void mkfn_header(char *fontname)
 
 int otf_read(void);
 int afm_read(void);
+int t1_read(void);
+
+/* Type 1 fonts start with a PFB segment header or a PostScript comment */
+static int t1_input(void)
+{
+	int c = getc(stdin);
+	ungetc(c, stdin);
+	return c == 0x80 || c == '%';
+}
 
 static char *usage =
 	"Usage: mkfn [options] <input >output\n"
 	"Options:\n"
-	"  -a      \tread an AFM file (default)\n"
+	"  -a      \tread an AFM file or a Type 1 font (default)\n"
 	"  -o      \tread a TTF or an OTF file\n"
+	"  -u map  \tCID to Unicode mapping for CID-keyed AFM files\n"
 	"  -s      \tspecial font\n"
 	"  -p name \toverride font postscript name\n"
 	"  -t name \tset font troff name\n"
@@ -177,6 +266,8 @@ static char *usage =
 	"  -S scrs \tcomma-separated list of scripts to include (list to list)\n"
 	"  -L langs\tcomma-separated list of languages to include (list to list)\n"
 	"  -F font \tfont name or index in a font collection (list to list)\n"
+	"  -V inst \tvariable font instance name or index, or axis\n"
+	"          \tcoordinates like wght=700,wdth=75 (list to list)\n"
 	"  -w      \twarn about unsupported font features\n";
 
 int main(int argc, char *argv[])
@@ -233,6 +324,13 @@ int main(int argc, char *argv[])
 		case 't':
 			mkfn_trname = argv[i][2] ? argv[i] + 2 : argv[++i];
 			break;
+		case 'u':
+			mkfn_cidmap = argv[i][2] ? argv[i] + 2 : argv[++i];
+			break;
+		case 'V':
+			mkfn_instname = argv[i][2] ? argv[i] + 2 : argv[++i];
+			mkfn_dry = !strcmp("list", mkfn_instname);
+			break;
 		case 'w':
 			mkfn_warn = 1;
 			break;
@@ -242,7 +340,7 @@ int main(int argc, char *argv[])
 		}
 	}
 	trfn_init();
-	if ((afm ? afm_read() : otf_read())) {
+	if ((afm ? (t1_input() ? t1_read() : afm_read()) : otf_read())) {
 		fprintf(stderr, "neatmkfn: cannot parse the font\n");
 		trfn_done();
 		return 1;
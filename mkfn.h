@@ -3,11 +3,34 @@ void mkfn_trfont(char *name);
 void mkfn_psfont(char *fontname);
 void mkfn_header(char *fontname);
 void mkfn_char(char *c, int n, int u, int wid, int llx, int lly, int urx, int ury);
+void mkfn_alias(int u, int vs);
 void mkfn_kern(char *c1, char *c2, int x);
 int mkfn_font(char *font);
+int mkfn_instance(char *name);
+int mkfn_axis(char *axis, double *val);
 int mkfn_script(char *script, int nscripts);
 int mkfn_lang(char *lang, int nlangs);
 int mkfn_featrank(char *scrp, char *feat);
+int mkfn_cidcode(int cid);
+int mkfn_uwid(int w);
+int mkfn_ifloor(double d);
+
+/* the bounding boxes of glyph outlines, used by otf.c and t1.c */
+struct bbox {
+	double x, y;		/* current point */
+	int moved;		/* current point starts a contour */
+	int n;			/* number of points in b[] */
+	double b[4];		/* bounding box */
+};
+
+void bbox_move(struct bbox *bb, double x, double y);
+void bbox_line(struct bbox *bb, double x, double y);
+void bbox_curve(struct bbox *bb, double x1, double y1,
+		double x2, double y2, double x3, double y3);
+void bbox_get(struct bbox *bb, double scl, int *box);
+
+/* WOFF and WOFF2 decoding, used by otf.c */
+char *woff_sfnt(char *woff, long len, long *sfntlen);
 
 /* functions defined in trfn.c and used by mkfn.c */
 void trfn_init(void);
@@ -34,6 +57,7 @@ char *sbuf_done(struct sbuf *sb);
 void sbuf_str(struct sbuf *sbuf, char *s);
 void sbuf_mem(struct sbuf *sbuf, char *s, int len);
 char *sbuf_buf(struct sbuf *sb);
+int sbuf_len(struct sbuf *sbuf);
 void sbuf_printf(struct sbuf *sbuf, char *s, ...);
 
 /* dictionary */
@@ -1,27 +1,38 @@
 /* OpenType and TrueType fonts */
-#include <arpa/inet.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "mkfn.h"
 
 #define MAX(a, b)	((a) < (b) ? (b) : (a))
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define LEN(a)		(sizeof(a) / sizeof((a)[0]))
 
 #define NGLYPHS		(1 << 16)
-#define NLOOKUPS	(1 << 12)
 #define GNLEN		(64)
 #define NGRPS		2048
+#define NGHASH		(1 << 14)	/* glyph group hash table size */
+#define NTABS		256	/* size of the table directory hash */
 
-#define U32(buf, off)		(htonl(*(u32 *) ((buf) + (off))))
-#define U16(buf, off)		(htons(*(u16 *) ((buf) + (off))))
+/* big-endian loads; the addresses may be unaligned */
 #define U8(buf, off)		(*(u8 *) ((buf) + (off)))
-#define S16(buf, off)		((s16) htons(*(u16 *) ((buf) + (off))))
-#define S32(buf, off)		((s32) htonl(*(u32 *) ((buf) + (off))))
+#define U16(buf, off)		((U8(buf, off) << 8) | U8(buf, (off) + 1))
+#define U24(buf, off)		(((u32) U8(buf, off) << 16) | U16(buf, (off) + 1))
+#define U32(buf, off)		(((u32) U16(buf, off) << 16) | U16(buf, (off) + 2))
+#define S16(buf, off)		((s16) U16(buf, off))
+#define S32(buf, off)		((s32) U32(buf, off))
 
-#define GCTXLEN		16	/* number of context backtrack coverage arrays */
+#define NCODES		0x110000	/* number of Unicode codepoints */
+#define NAXES		16	/* maximum number of variation axes */
+#define NPTS		(1 << 16)	/* maximum number of instanced glyph points */
+#define GCTXRULES	(1 << 16)	/* maximum rules printed for a context */
+#define NGRULES		(1 << 24)	/* maximum length of decoded nested lookups */
+#define GCTXGLYPH	(1 << 24)	/* gsub context entries that are glyphs */
 
 typedef unsigned int u32;
 typedef unsigned short u16;
@@ -35,17 +46,41 @@ static int glyph_bbox[NGLYPHS][4];
 static int glyph_wid[NGLYPHS];
 static int glyph_n;
 static int upm;			/* units per em */
+static void *otf_beg;		/* the beginning of the font file */
+static long otf_len;		/* the length of the font file */
 static int sec;			/* current font section (lookup index * 10) */
 
+/* an entry of the table directory */
+struct otftab {
+	u32 tag;		/* table tag */
+	void *tab;		/* table data */
+	long len;		/* table length */
+};
+
 struct otf {
 	void *otf;		/* TTC header or offset table */
 	void *off;		/* offset table */
+	long len;		/* font file length */
 	char name[128];		/* font name */
+	struct otftab tabs[NTABS];	/* table directory, hashed on tags */
 };
 
 static char *macset[];
 static char *stdset[];
 
+/*
+ * Whether len bytes at offset off of tab are inside the font file.
+ * Table readers check the extent of each array once with otf_in()
+ * and read its elements with unchecked U8/U16/U32 afterwards.
+ */
+static int otf_in(void *tab, long off, long len)
+{
+	long beg = (char *) tab - (char *) otf_beg;
+	return beg >= 0 && off >= 0 && len >= 0 &&
+		beg <= otf_len && off <= otf_len - beg &&
+		len <= otf_len - beg - off;
+}
+
 static int owid(int w)
 {
 	return (w < 0 ? w * 1000 - upm / 2 : w * 1000 + upm / 2) / upm;
@@ -53,8 +88,23 @@ static int owid(int w)
 
 static int uwid(int w)
 {
-	int d = 72000 / mkfn_res;
-	return (w < 0 ? owid(w) - d / 20 : owid(w) + d / 20) * 10 / d;
+	return mkfn_uwid(owid(w));
+}
+
+static int uwid_upm;			/* the upm of uwid_tab */
+static int uwid_tab[1 << 16];		/* uwid() of 16-bit font units */
+
+/* uwid() for raw 16-bit font values, using uwid_tab */
+#define UWID(v)		(uwid_tab[(v)])
+
+static void uwid_init(void)
+{
+	int i;
+	if (uwid_upm == upm)
+		return;
+	for (i = 0; i < (1 << 16); i++)
+		uwid_tab[i] = uwid((s16) i);
+	uwid_upm = upm;
 }
 
 /* whether the script is right-to-left */
@@ -74,6 +124,47 @@ static char *gname(int id)
 	return str;
 }
 
+/* read n 16-bit values, which are stride (2 or 4) bytes apart */
+static void otf_u16s(int *dst, void *src, int n, int stride)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i mask = _mm_set1_epi32(0xffff);
+	__m128i v;
+	for (; stride == 2 && i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((void *) (src + 2 * i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((void *) (dst + i), _mm_unpacklo_epi16(v, zero));
+		_mm_storeu_si128((void *) (dst + i + 4), _mm_unpackhi_epi16(v, zero));
+	}
+	for (; stride == 4 && i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((void *) (src + 4 * i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((void *) (dst + i), _mm_and_si128(v, mask));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = U16(src, stride * i);
+}
+
+/* read n 32-bit values */
+static void otf_u32s(u32 *dst, void *src, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i v;
+	for (; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((void *) (src + 4 * i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+		_mm_storeu_si128((void *) (dst + i), v);
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = U32(src, 4 * i);
+}
+
 /* report unsupported otf tables */
 static void otf_unsupported(char *sub, int type, int fmt)
 {
@@ -85,40 +176,496 @@ static void otf_unsupported(char *sub, int type, int fmt)
 	}
 }
 
-/* find the otf table with the given name */
-static void *otf_table(struct otf *otf, char *name)
+static int otf_tabhash(u32 tag)
+{
+	return ((tag * 2654435761u) >> 24) & (NTABS - 1);
+}
+
+/* build the table directory; tables outside the file are ignored */
+static void otf_tabinit(struct otf *otf)
 {
+	long off = otf->off - otf->otf;
 	int nrecs = U16(otf->off, 4);
-	int i;
-	for (i = 0; i < nrecs; i++) {
+	int i, h;
+	memset(otf->tabs, 0, sizeof(otf->tabs));
+	if (off + 12 + 16L * nrecs > otf->len)
+		nrecs = (otf->len - off - 12) / 16;
+	for (i = 0; i < nrecs && i < NTABS / 2; i++) {
 		void *rec = otf->off + 12 + i * 16;	/* an otf table record */
-		if (!strncmp(rec, name, 4))
-			return otf->otf + U32(rec, 8);
+		u32 tag = U32(rec, 0);
+		unsigned long beg = U32(rec, 8);
+		unsigned long len = U32(rec, 12);
+		if (beg > otf->len || len > otf->len - beg) {
+			if (mkfn_warn)
+				fprintf(stderr, "neatmkfn: bad table <%.4s>\n", (char *) rec);
+			continue;
+		}
+		h = otf_tabhash(tag);
+		while (otf->tabs[h].tab && otf->tabs[h].tag != tag)
+			h = (h + 1) & (NTABS - 1);
+		if (otf->tabs[h].tab)		/* the first record wins */
+			continue;
+		otf->tabs[h].tag = tag;
+		otf->tabs[h].tab = otf->otf + beg;
+		otf->tabs[h].len = len;
+	}
+}
+
+static struct otftab *otf_tabent(struct otf *otf, char *name)
+{
+	u32 tag = ((u32) (u8) name[0] << 24) | ((u32) (u8) name[1] << 16) |
+		((u32) (u8) name[2] << 8) | (u8) name[3];
+	int h = otf_tabhash(tag);
+	while (otf->tabs[h].tab) {
+		if (otf->tabs[h].tag == tag)
+			return &otf->tabs[h];
+		h = (h + 1) & (NTABS - 1);
 	}
 	return NULL;
 }
 
-/* obtain postscript font name from name table */
-static void otf_name(struct otf *otf, void *tab)
+/* find the otf table with the given name */
+static void *otf_table(struct otf *otf, char *name)
 {
-	char name[256];
-	void *str = tab + U16(tab, 4);		/* storage area */
-	int n = U16(tab, 2);			/* number of name records */
-	int i;
-	for (i = 0; i < n; i++) {
+	struct otftab *tab = otf_tabent(otf, name);
+	return tab ? tab->tab : NULL;
+}
+
+/* the length of the otf table with the given name */
+static long otf_tablen(struct otf *otf, char *name)
+{
+	struct otftab *tab = otf_tabent(otf, name);
+	return tab ? tab->len : 0;
+}
+
+/* copy the name with the given id to dst; prefer macintosh names */
+static int otf_namestr(void *tab, int nid, char *dst, int len)
+{
+	void *str;				/* storage area */
+	int found = 0;
+	int n;					/* number of name records */
+	int i, j;
+	dst[0] = '\0';
+	if (!tab || !otf_in(tab, 0, 6))
+		return 1;
+	str = tab + U16(tab, 4);
+	n = U16(tab, 2);
+	if (!otf_in(tab, 6, 12 * n))
+		return 1;
+	for (i = 0; i < n && found < 2; i++) {
 		void *rec = tab + 6 + 12 * i;
 		int pid = U16(rec, 0);		/* platform id */
 		int eid = U16(rec, 2);		/* encoding id */
 		int lid = U16(rec, 4);		/* language id */
-		int nid = U16(rec, 6);		/* name id */
-		int len = U16(rec, 8);		/* string length */
+		int sz = U16(rec, 8);		/* string length */
 		int off = U16(rec, 10);		/* string offset  */
-		if (pid == 1 && eid == 0 && lid == 0 && nid == 6) {
-			memcpy(name, str + off, len);
-			name[len] = '\0';
-			snprintf(otf->name, sizeof(otf->name), "%s", name);
+		if (U16(rec, 6) != nid || !otf_in(str, off, sz))
+			continue;
+		if (pid == 1 && eid == 0 && lid == 0) {
+			sz = MIN(sz, len - 1);
+			memcpy(dst, str + off, sz);
+			dst[sz] = '\0';
+			found = 2;
+		}
+		if (pid == 3 && eid == 1 && !found) {
+			/* utf-16 names; only ascii characters are kept */
+			for (j = 0; j < sz / 2 && j < len - 1; j++)
+				dst[j] = U8(str, off + 2 * j) ? '?' :
+					U8(str, off + 2 * j + 1);
+			dst[j] = '\0';
+			found = lid == 0x409 ? 1 : 0;
+			if (!found && !dst[0])
+				continue;
+		}
+	}
+	return !dst[0];
+}
+
+/* obtain postscript font name from name table */
+static void otf_name(struct otf *otf, void *tab)
+{
+	char name[256];
+	if (!otf_namestr(tab, 6, name, sizeof(name)))
+		snprintf(otf->name, sizeof(otf->name), "%s", name);
+}
+
+static int iround(double d)
+{
+	return mkfn_ifloor(d + 0.5);
+}
+
+/* variable fonts */
+static int var_n;			/* number of axes, if instancing */
+static double var_crd[NAXES];		/* normalized instance coordinates */
+
+/* item variation stores */
+struct ivs {
+	void *tab;		/* variation store table */
+	double *scl;		/* variation region scalars */
+	int nregs;		/* number of variation regions */
+};
+
+static struct ivs var_gdef;		/* GDEF variation store */
+
+/*
+ * The scalar of a variation region for the instance.  The start,
+ * peak, and end F2Dot14 coordinates of axis i are at beg, peak, and
+ * end plus i * step.  If beg or end is NULL, the region is implied
+ * by its peak.
+ */
+static double var_region(void *beg, void *peak, void *end, int step, int n)
+{
+	double s = 1;
+	int i;
+	for (i = 0; i < n; i++) {
+		double v = i < var_n ? var_crd[i] : 0;
+		double p = S16(peak, i * step) / 16384.0;
+		double b = beg ? S16(beg, i * step) / 16384.0 : MIN(0, p);
+		double e = end ? S16(end, i * step) / 16384.0 : MAX(0, p);
+		if (p == 0 || b > p || p > e || (b < 0 && e > 0))
+			continue;
+		if (v < b || v > e)
+			return 0;
+		if (v != p)
+			s *= v < p ? (v - b) / (p - b) : (e - v) / (e - p);
+	}
+	return s;
+}
+
+/* read an item variation store and compute its region scalars */
+static void ivs_init(struct ivs *ivs, void *tab)
+{
+	void *rl;			/* variation region list */
+	int nax, i;
+	memset(ivs, 0, sizeof(*ivs));
+	if (!otf_in(tab, 0, 8) || U16(tab, 0) != 1 ||
+			!otf_in(tab, 8, 4 * U16(tab, 6)))
+		return;
+	rl = tab + U32(tab, 2);
+	if (!otf_in(rl, 0, 4))
+		return;
+	nax = U16(rl, 0);
+	if (!otf_in(rl, 4, 6L * nax * U16(rl, 2)))
+		return;
+	ivs->tab = tab;
+	ivs->nregs = U16(rl, 2);
+	ivs->scl = malloc((ivs->nregs + 1) * sizeof(ivs->scl[0]));
+	for (i = 0; i < ivs->nregs; i++) {
+		void *reg = rl + 4 + 6 * nax * i;
+		ivs->scl[i] = var_region(reg, reg + 2, reg + 4, 6, nax);
+	}
+}
+
+static void ivs_done(struct ivs *ivs)
+{
+	free(ivs->scl);
+	memset(ivs, 0, sizeof(*ivs));
+}
+
+/* the scalars of the regions of an item variation data subtable */
+static int ivs_scalars(struct ivs *ivs, int outer, double *scl, int max)
+{
+	void *data;
+	int n, i;
+	if (!ivs->tab || outer < 0 || outer >= U16(ivs->tab, 6))
+		return 0;
+	data = ivs->tab + U32(ivs->tab, 8 + 4 * outer);
+	if (!otf_in(data, 0, 6) || !otf_in(data, 6, 2 * U16(data, 4)))
+		return 0;
+	n = MIN(U16(data, 4), max);
+	for (i = 0; i < n; i++)
+		scl[i] = U16(data, 6 + 2 * i) < ivs->nregs ?
+			ivs->scl[U16(data, 6 + 2 * i)] : 0;
+	return n;
+}
+
+/* the delta of an item of a variation store for the instance */
+static double ivs_delta(struct ivs *ivs, int outer, int inner)
+{
+	void *data, *row;
+	int wcnt, lng, nregs;
+	long rowlen;
+	double d = 0;
+	int i;
+	if (!ivs->tab || outer >= U16(ivs->tab, 6))
+		return 0;
+	data = ivs->tab + U32(ivs->tab, 8 + 4 * outer);
+	if (!otf_in(data, 0, 6) || inner >= U16(data, 0))
+		return 0;
+	wcnt = U16(data, 2) & 0x7fff;
+	lng = U16(data, 2) & 0x8000;
+	nregs = U16(data, 4);
+	rowlen = lng ? 4 * wcnt + 2 * (nregs - wcnt) : 2 * wcnt + (nregs - wcnt);
+	row = data + 6 + 2 * nregs + inner * rowlen;
+	if (wcnt > nregs || !otf_in(data, 6, 2 * nregs) || !otf_in(row, 0, rowlen))
+		return 0;
+	for (i = 0; i < nregs; i++) {
+		int reg = U16(data, 6 + 2 * i);
+		double scl = reg < ivs->nregs ? ivs->scl[reg] : 0;
+		long val;
+		if (i < wcnt)
+			val = lng ? S32(row, 4 * i) : S16(row, 2 * i);
+		else if (lng)
+			val = S16(row, 4 * wcnt + 2 * (i - wcnt));
+		else
+			val = (signed char) U8(row, 2 * wcnt + (i - wcnt));
+		d += val * scl;
+	}
+	return d;
+}
+
+/* the outer and inner indices of item i of a delta-set index map */
+static void ivs_map(void *map, long i, int *outer, int *inner)
+{
+	int fmt, efmt, esz, ibits;
+	long cnt, ent = 0;
+	int j;
+	*outer = 0;
+	*inner = i;
+	if (!map || !otf_in(map, 0, 2))
+		return;
+	fmt = U8(map, 0);
+	efmt = U8(map, 1);
+	if (!otf_in(map, 0, fmt ? 6 : 4))
+		return;
+	cnt = fmt ? U32(map, 2) : U16(map, 2);
+	esz = ((efmt >> 4) & 3) + 1;
+	ibits = (efmt & 15) + 1;
+	if (cnt <= 0 || !otf_in(map, fmt ? 6 : 4, cnt * esz))
+		return;
+	i = MIN(i, cnt - 1);
+	for (j = 0; j < esz; j++)
+		ent = (ent << 8) | U8(map, (fmt ? 6 : 4) + i * esz + j);
+	*outer = ent >> ibits;
+	*inner = ent & ((1 << ibits) - 1);
+}
+
+/* the delta of a VariationIndex device table */
+static int var_device(void *dev)
+{
+	if (!var_n || !otf_in(dev, 0, 6) || U16(dev, 4) != 0x8000)
+		return 0;
+	return iround(ivs_delta(&var_gdef, U16(dev, 0), U16(dev, 2)));
+}
+
+/* map a normalized coordinate with an avar segment map */
+static double var_avar(void *map, double v)
+{
+	int n = U16(map, 0);
+	int i;
+	for (i = 1; i < n; i++) {
+		double f0 = S16(map, 2 + 4 * (i - 1)) / 16384.0;
+		double t0 = S16(map, 4 + 4 * (i - 1)) / 16384.0;
+		double f1 = S16(map, 2 + 4 * i) / 16384.0;
+		double t1 = S16(map, 4 + 4 * i) / 16384.0;
+		if (v <= f0)
+			return t0;
+		if (v <= f1)
+			return f1 == f0 ? t0 : t0 + (v - f0) * (t1 - t0) / (f1 - f0);
+	}
+	return v;
+}
+
+/* select the instance of a variable font; return nonzero if it is missing */
+static int otf_fvar(struct otf *otf, void *fvar)
+{
+	void *name = otf_table(otf, "name");
+	void *avar = otf_table(otf, "avar");
+	void *axes, *insts, *map;
+	char iname[128] = "", psname[128] = "", tag[8];
+	double crd[NAXES];
+	int nax, axsz, ninst, instsz;
+	int sel = 0;
+	int i;
+	if (!fvar || !otf_in(fvar, 0, 16))
+		return mkfn_instance(NULL);
+	axes = fvar + U16(fvar, 4);
+	nax = U16(fvar, 8);
+	axsz = U16(fvar, 10);
+	ninst = U16(fvar, 12);
+	instsz = U16(fvar, 14);
+	if (nax > NAXES || axsz < 20 || instsz < 4 + 4 * nax ||
+			!otf_in(axes, 0, (long) nax * axsz + (long) ninst * instsz))
+		return mkfn_instance(NULL);
+	insts = axes + nax * axsz;
+	for (i = 0; i < nax; i++)
+		crd[i] = S32(axes + i * axsz, 8) / 65536.0;
+	for (i = 0; i < ninst; i++) {
+		void *inst = insts + i * instsz;
+		char cur[128];
+		int j;
+		otf_namestr(name, U16(inst, 0), cur, sizeof(cur));
+		if (mkfn_instance(cur) && !sel) {
+			sel = 1;
+			strcpy(iname, cur);
+			for (j = 0; j < nax; j++)
+				crd[j] = S32(inst, 4 + 4 * j) / 65536.0;
+			if (instsz >= 6 + 4 * nax)
+				otf_namestr(name, U16(inst, 4 + 4 * nax),
+					psname, sizeof(psname));
+		}
+	}
+	for (i = 0; i < nax; i++) {
+		memcpy(tag, axes + i * axsz, 4);
+		tag[4] = '\0';
+		if (strchr(tag, ' '))
+			*strchr(tag, ' ') = '\0';
+		if (mkfn_axis(tag, &crd[i]))
+			sel = 1;
+	}
+	if (!sel)
+		return mkfn_instance(NULL);
+	/* normalized coordinates */
+	map = avar && otf_in(avar, 0, 8) && U16(avar, 6) == nax ? avar + 8 : NULL;
+	for (i = 0; i < nax; i++) {
+		void *ax = axes + i * axsz;
+		double min = S32(ax, 4) / 65536.0;
+		double def = S32(ax, 8) / 65536.0;
+		double max = S32(ax, 12) / 65536.0;
+		double v = MAX(min, MIN(max, crd[i]));
+		double n = 0;
+		if (v < def && def > min)
+			n = (v - def) / (def - min);
+		if (v > def && max > def)
+			n = (v - def) / (max - def);
+		n = iround(n * 16384) / 16384.0;
+		if (map && otf_in(map, 0, 2) && otf_in(map, 2, 4 * U16(map, 0))) {
+			n = iround(var_avar(map, n) * 16384) / 16384.0;
+			map += 2 + 4 * U16(map, 0);
+		} else {
+			map = NULL;
+		}
+		var_crd[i] = n;
+	}
+	var_n = nax;
+	/* instance postscript name */
+	if (!psname[0] && iname[0]) {
+		char *s, *d = psname;
+		if (otf_namestr(name, 25, psname, sizeof(psname)) &&
+				otf_namestr(name, 16, psname, sizeof(psname)))
+			otf_namestr(name, 1, psname, sizeof(psname));
+		for (s = psname; *s; s++)
+			if (*s != ' ')
+				*d++ = *s;
+		*d++ = '-';
+		for (s = iname; *s && d < psname + sizeof(psname) - 1; s++)
+			if (*s != ' ')
+				*d++ = *s;
+		*d = '\0';
+	}
+	if (psname[0])
+		snprintf(otf->name, sizeof(otf->name), "%s", psname);
+	return 0;
+}
+
+static int intcmp(void *v1, void *v2)
+{
+	return *(int *) v1 - *(int *) v2;
+}
+
+static int longcmp(void *v1, void *v2)
+{
+	long l1 = *(long *) v1;
+	long l2 = *(long *) v2;
+	return l1 < l2 ? -1 : l1 > l2;
+}
+
+/* cmap segments: glyphs beg to end map to codepoints from code */
+struct cmapseg {
+	int beg, end;
+	int code;
+};
+
+static struct cmapseg *cmap_segs;
+static int cmap_n;
+static int cmap_sz;
+static int *cmap_codes;			/* codepoints of all glyphs */
+static int cmap_beg[NGLYPHS + 1];	/* the first codepoint of each glyph */
+
+/* unicode variation sequences */
+struct cmapuvs {
+	int glyph;		/* glyph index */
+	int code;		/* base codepoint */
+	int vs;			/* variation selector */
+};
+
+static struct cmapuvs *uvs;
+static int uvs_n;
+static int uvs_sz;
+
+static void cmap_add(long beg, long end, long code)
+{
+	struct cmapseg *last = cmap_n ? &cmap_segs[cmap_n - 1] : NULL;
+	if (beg < 0 || beg > end || beg >= NGLYPHS || code < 0)
+		return;
+	end = MIN(end, NGLYPHS - 1);
+	if (last && last->end + 1 == beg && last->code + beg - last->beg == code) {
+		last->end = end;
+		return;
+	}
+	if (cmap_n == cmap_sz) {
+		cmap_sz = cmap_sz ? cmap_sz * 2 : 256;
+		cmap_segs = realloc(cmap_segs, cmap_sz * sizeof(cmap_segs[0]));
+	}
+	cmap_segs[cmap_n].beg = beg;
+	cmap_segs[cmap_n].end = end;
+	cmap_segs[cmap_n].code = code;
+	cmap_n++;
+}
+
+/*
+ * Map glyphs to codepoints from cmap segments; later segments take
+ * precedence.  The segments are visited backwards and next[] skips
+ * the codepoints already mapped, so each is visited once.  The
+ * codepoints of glyph g are stored in cmap_codes[] from cmap_beg[g]
+ * to cmap_beg[g + 1]; the first is the one of the segment with the
+ * highest precedence and is also stored in glyph_code[].
+ */
+static void cmap_map(void)
+{
+	static int next[NCODES + 1];
+	int *gl = NULL, *cp = NULL;	/* glyph-codepoint pairs */
+	int n = 0, sz = 0;
+	int i, c, r;
+	for (i = 0; i <= NCODES; i++)
+		next[i] = i;
+	for (i = cmap_n - 1; i >= 0; i--) {
+		struct cmapseg *seg = &cmap_segs[i];
+		int end = MIN(NCODES - 1, seg->code + seg->end - seg->beg);
+		for (c = seg->code; c <= end; c = r) {
+			for (r = c; next[r] != r; r = next[r])
+				next[r] = next[next[r]];
+			if (r != c)
+				continue;
+			if (n == sz) {
+				sz = sz ? sz * 2 : 1024;
+				gl = realloc(gl, sz * sizeof(gl[0]));
+				cp = realloc(cp, sz * sizeof(cp[0]));
+			}
+			gl[n] = seg->beg + c - seg->code;
+			cp[n] = c;
+			n++;
+			next[c] = r = c + 1;
 		}
 	}
+	/* counting sort on glyphs, keeping the order of codepoints */
+	memset(cmap_beg, 0, sizeof(cmap_beg));
+	for (i = 0; i < n; i++)
+		cmap_beg[gl[i]]++;
+	for (i = 1; i <= NGLYPHS; i++)
+		cmap_beg[i] += cmap_beg[i - 1];
+	cmap_codes = realloc(cmap_codes, (n + 1) * sizeof(cmap_codes[0]));
+	for (i = n - 1; i >= 0; i--)
+		cmap_codes[--cmap_beg[gl[i]]] = cp[i];
+	for (i = 0; i < NGLYPHS; i++) {
+		int cnt = cmap_beg[i + 1] - cmap_beg[i];
+		glyph_code[i] = cnt ? cmap_codes[cmap_beg[i]] : 0;
+		if (cnt > 2)
+			qsort(cmap_codes + cmap_beg[i] + 1, cnt - 1,
+				sizeof(cmap_codes[0]), (void *) intcmp);
+	}
+	free(gl);
+	free(cp);
 }
 
 /* parse otf cmap format 4 subtable */
@@ -128,7 +675,11 @@ static void otf_cmap4(struct otf *otf, void *cmap4)
 	void *ends, *begs, *deltas, *offsets;
 	int beg, end, delta, offset;
 	int i, j;
+	if (!otf_in(cmap4, 0, 14))
+		return;
 	nsegs = U16(cmap4, 6) / 2;
+	if (!otf_in(cmap4, 14, 8 * nsegs + 2))
+		return;
 	ends = cmap4 + 14;
 	begs = ends + 2 * nsegs + 2;
 	deltas = begs + 2 * nsegs;
@@ -138,31 +689,181 @@ static void otf_cmap4(struct otf *otf, void *cmap4)
 		end = U16(ends, 2 * i);
 		delta = U16(deltas, 2 * i);
 		offset = U16(offsets, 2 * i);
+		if (offset && end >= beg &&
+				!otf_in(offsets + 2 * i, offset, (end - beg + 1) * 2))
+			continue;
 		if (offset) {
-			for (j = beg; j <= end; j++)
-				glyph_code[(U16(offsets + 2 * i,
-					offset + (j - beg) * 2) + delta) & 0xffff] = j;
-		} else {
-			for (j = beg; j <= end; j++)
-				glyph_code[(j + delta) & 0xffff] = j;
+			for (j = beg; j <= end; j++) {
+				int g = (U16(offsets + 2 * i,
+					offset + (j - beg) * 2) + delta) & 0xffff;
+				cmap_add(g, g, j);
+			}
+		} else if (end >= beg) {
+			int g = (beg + delta) & 0xffff;
+			cmap_add(g, MIN(0xffff, g + end - beg), beg);
+			if (g + end - beg > 0xffff)
+				cmap_add(0, g + end - beg - 0x10000, beg + 0x10000 - g);
+		}
+	}
+}
+
+/* parse otf cmap format 12 and 13 subtables */
+static void otf_cmap12(struct otf *otf, void *cmap12)
+{
+	int fmt;
+	long n;
+	long i;
+	if (!otf_in(cmap12, 0, 16))
+		return;
+	fmt = U16(cmap12, 0);
+	n = U32(cmap12, 12);
+	if (!otf_in(cmap12, 16, 12 * n))
+		return;
+	/* backwards, so that smaller codepoints take precedence */
+	for (i = n - 1; i >= 0; i--) {
+		void *grp = cmap12 + 16 + 12 * i;
+		long beg = U32(grp, 0);
+		long end = U32(grp, 4);
+		long gid = U32(grp, 8);
+		if (beg > end || end > 0x10ffff)
+			continue;
+		if (fmt == 12)
+			cmap_add(gid, gid + end - beg, beg);
+		else
+			cmap_add(gid, gid, beg);
+	}
+}
+
+static void uvs_add(int glyph, int code, int vs)
+{
+	if (glyph <= 0 || glyph >= NGLYPHS)
+		return;
+	if (uvs_n == uvs_sz) {
+		uvs_sz = uvs_sz ? uvs_sz * 2 : 256;
+		uvs = realloc(uvs, uvs_sz * sizeof(uvs[0]));
+	}
+	uvs[uvs_n].glyph = glyph;
+	uvs[uvs_n].code = code;
+	uvs[uvs_n].vs = vs;
+	uvs_n++;
+}
+
+static int uvscmp(void *v1, void *v2)
+{
+	struct cmapuvs *u1 = v1, *u2 = v2;
+	if (u1->glyph != u2->glyph)
+		return u1->glyph - u2->glyph;
+	if (u1->code != u2->code)
+		return u1->code - u2->code;
+	return u1->vs - u2->vs;
+}
+
+/* the glyph of codepoint c; rev holds glyph-codepoint pairs sorted on codes */
+static int cmap_glyph(struct cmapuvs *rev, int n, int c)
+{
+	int l = 0;
+	int h = n;
+	while (l < h) {
+		int m = (l + h) / 2;
+		if (rev[m].code == c)
+			return rev[m].glyph;
+		if (c < rev[m].code)
+			h = m;
+		else
+			l = m + 1;
+	}
+	return -1;
+}
+
+static int codecmp(void *v1, void *v2)
+{
+	return ((struct cmapuvs *) v1)->code - ((struct cmapuvs *) v2)->code;
+}
+
+/* parse otf cmap format 14 subtable (unicode variation sequences) */
+static void otf_cmap14(struct otf *otf, void *cmap14)
+{
+	struct cmapuvs *rev;		/* glyphs of codepoints */
+	int nrev = cmap_beg[NGLYPHS];
+	long n, cnt;
+	long i, j;
+	int k, g;
+	if (!otf_in(cmap14, 0, 10))
+		return;
+	n = U32(cmap14, 6);
+	if (!otf_in(cmap14, 10, 11 * n))
+		return;
+	rev = malloc((nrev + 1) * sizeof(rev[0]));
+	for (g = 0; g < NGLYPHS; g++) {
+		for (k = cmap_beg[g]; k < cmap_beg[g + 1]; k++) {
+			rev[k].glyph = g;
+			rev[k].code = cmap_codes[k];
+		}
+	}
+	qsort(rev, nrev, sizeof(rev[0]), (void *) codecmp);
+	for (i = 0; i < n; i++) {
+		void *rec = cmap14 + 10 + 11 * i;
+		int vs = U24(rec, 0);
+		void *def = U32(rec, 3) ? cmap14 + U32(rec, 3) : NULL;
+		void *ndef = U32(rec, 7) ? cmap14 + U32(rec, 7) : NULL;
+		/* default uvs: sequences showing the glyph of the base */
+		if (def && otf_in(def, 0, 4) &&
+				otf_in(def, 4, 4 * (cnt = U32(def, 0)))) {
+			for (j = 0; j < cnt; j++) {
+				int beg = U24(def, 4 + 4 * j);
+				int end = beg + U8(def, 4 + 4 * j + 3);
+				for (k = beg; k <= end; k++)
+					uvs_add(cmap_glyph(rev, nrev, k), k, vs);
+			}
+		}
+		/* non-default uvs: sequences with glyphs of their own */
+		if (ndef && otf_in(ndef, 0, 4) &&
+				otf_in(ndef, 4, 5 * (cnt = U32(ndef, 0)))) {
+			for (j = 0; j < cnt; j++)
+				uvs_add(U16(ndef, 4 + 5 * j + 3),
+					U24(ndef, 4 + 5 * j), vs);
 		}
 	}
+	free(rev);
 }
 
 /* parse otf cmap header */
 static void otf_cmap(struct otf *otf, void *cmap)
 {
-	int nrecs = U16(cmap, 2);
-	int i;
+	int nrecs;
+	int i, pass;
+	if (!otf_in(cmap, 0, 4))
+		return;
+	nrecs = U16(cmap, 2);
+	if (!otf_in(cmap, 4, 8 * nrecs))
+		return;
+	cmap_n = 0;
+	/* format 4 subtables are read last to take precedence */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nrecs; i++) {
+			void *rec = cmap + 4 + i * 8;	/* a cmap record */
+			int plat = U16(rec, 0);
+			int enc = U16(rec, 2);
+			void *tab = cmap + U32(rec, 4);	/* a cmap subtable */
+			int fmt = otf_in(tab, 0, 2) ? U16(tab, 0) : 0;
+			int uni = (plat == 3 && enc == 10) || (plat == 0 && enc >= 4);
+			if (!pass && uni && (fmt == 12 || fmt == 13))
+				otf_cmap12(otf, tab);
+			if (pass && plat == 3 && enc == 1 && fmt == 4)
+				otf_cmap4(otf, tab);
+		}
+	}
+	cmap_map();
+	uvs_n = 0;
 	for (i = 0; i < nrecs; i++) {
-		void *rec = cmap + 4 + i * 8;	/* a cmap record */
-		int plat = U16(rec, 0);
-		int enc = U16(rec, 2);
-		void *tab = cmap + U32(rec, 4);	/* a cmap subtable */
-		int fmt = U16(tab, 0);
-		if (plat == 3 && enc == 1 && fmt == 4)
-			otf_cmap4(otf, tab);
+		void *rec = cmap + 4 + i * 8;
+		void *tab = cmap + U32(rec, 4);
+		int fmt = otf_in(tab, 0, 2) ? U16(tab, 0) : 0;
+		if (U16(rec, 0) == 0 && U16(rec, 2) == 5 && fmt == 14)
+			otf_cmap14(otf, tab);
 	}
+	if (uvs_n)
+		qsort(uvs, uvs_n, sizeof(uvs[0]), (void *) uvscmp);
 }
 
 static void otf_post(struct otf *otf, void *post)
@@ -172,9 +873,11 @@ static void otf_post(struct otf *otf, void *post)
 	void *names;			/* glyph names */
 	int cname = 0;
 	int i;
-	if (U32(post, 0) != 0x20000)
+	if (!otf_in(post, 0, 34) || U32(post, 0) != 0x20000)
 		return;
 	post2 = post + 32;
+	if (!otf_in(post2, 2, 2 * U16(post2, 0)))
+		return;
 	glyph_n = U16(post2, 0);
 	index = post2 + 2;
 	names = index + 2 * glyph_n;
@@ -182,13 +885,504 @@ static void otf_post(struct otf *otf, void *post)
 		int idx = U16(index, 2 * i);
 		if (idx < 258) {
 			strcpy(glyph_name[i], macset[idx]);
-		} else {
+		} else if (otf_in(names, cname, 1) &&
+				otf_in(names, cname + 1, U8(names, cname))) {
+			int len = U8(names, cname);
 			memcpy(glyph_name[i], names + cname + 1,
-				U8(names, cname));
-			glyph_name[i][U8(names, cname)] = '\0';
-			cname += U8(names, cname) + 1;
+				len < GNLEN ? len : GNLEN - 1);
+			glyph_name[i][len < GNLEN ? len : GNLEN - 1] = '\0';
+			cname += len + 1;
+		}
+	}
+}
+
+/* glyf instancing */
+static void *gv_glyf;			/* glyf table */
+static u32 *gv_off;			/* glyph offsets */
+static int gv_n;			/* number of glyphs in loca */
+static void *gv_gvar;			/* gvar table */
+static void *gv_hmtx;			/* hmtx table */
+static int gv_nhmtx;			/* number of long horizontal metrics */
+static int glyph_vwid[NGLYPHS];		/* advance widths from phantom points */
+
+/* read packed point numbers; the count is -1 for all points */
+static void *gvar_points(void *d, void *lim, int *pts, int *cnt, int max)
+{
+	int total, cur = 0;
+	int i = 0, j;
+	*cnt = 0;
+	if (d + 1 > lim)
+		return lim;
+	total = U8(d, 0);
+	d++;
+	if (total & 0x80) {
+		if (d + 1 > lim)
+			return lim;
+		total = ((total & 0x7f) << 8) | U8(d, 0);
+		d++;
+	}
+	if (!total) {
+		*cnt = -1;
+		return d;
+	}
+	while (i < total && d < lim) {
+		int ctl = U8(d, 0);
+		int sz = ctl & 0x80 ? 2 : 1;
+		d++;
+		for (j = 0; j <= (ctl & 0x7f) && i < total; j++) {
+			if (d + sz > lim)
+				return lim;
+			cur += sz == 2 ? U16(d, 0) : U8(d, 0);
+			if (i < max)
+				pts[i] = cur;
+			i++;
+			d += sz;
+		}
+	}
+	*cnt = MIN(i, max);
+	return d;
+}
+
+/* read cnt packed deltas */
+static void *gvar_deltas(void *d, void *lim, double *v, int cnt)
+{
+	int i = 0, j;
+	while (i < cnt && d < lim) {
+		int ctl = U8(d, 0);
+		int sz = ctl & 0x80 ? (ctl & 0x40 ? 4 : 0) : (ctl & 0x40 ? 2 : 1);
+		d++;
+		for (j = 0; j <= (ctl & 0x3f) && i < cnt; j++) {
+			if (d + sz > lim)
+				return lim;
+			if (sz == 0)
+				v[i++] = 0;
+			if (sz == 1)
+				v[i++] = (signed char) U8(d, 0);
+			if (sz == 2)
+				v[i++] = S16(d, 0);
+			if (sz == 4)
+				v[i++] = S32(d, 0);
+			d += sz;
+		}
+	}
+	while (i < cnt)
+		v[i++] = 0;
+	return d;
+}
+
+/* infer the deltas of the untouched points of a contour */
+static void gvar_iup(double *c, double *d, int *touched, int beg, int end)
+{
+	int first = -1;
+	int i, j, k;
+	for (i = beg; i <= end && first < 0; i++)
+		if (touched[i])
+			first = i;
+	if (first < 0) {
+		for (i = beg; i <= end; i++)
+			d[i] = 0;
+		return;
+	}
+	i = first;
+	do {
+		j = i;
+		do
+			j = j < end ? j + 1 : beg;
+		while (!touched[j]);
+		for (k = i < end ? i + 1 : beg; k != j; k = k < end ? k + 1 : beg) {
+			double c1 = c[i] < c[j] ? c[i] : c[j];
+			double c2 = c[i] < c[j] ? c[j] : c[i];
+			double d1 = c[i] < c[j] ? d[i] : d[j];
+			double d2 = c[i] < c[j] ? d[j] : d[i];
+			if (c1 == c2)
+				d[k] = d1 == d2 ? d1 : 0;
+			else if (c[k] <= c1)
+				d[k] = d1;
+			else if (c[k] >= c2)
+				d[k] = d2;
+			else
+				d[k] = d1 + (c[k] - c1) * (d2 - d1) / (c2 - c1);
+		}
+		i = j;
+	} while (i != first);
+}
+
+/* add the gvar deltas of glyph g to its n points with nc contours */
+static void gvar_glyph(int g, double *x, double *y, int n, int *ends, int nc)
+{
+	void *gvar = gv_gvar;
+	void *gd, *lim, *hdr, *ser, *shared;
+	int nax, nshared, lng, ntup;
+	int *spts, *ppts, *pts, *touched;
+	double *dx, *dy, *ox, *oy, *vx, *vy;
+	long beg, end;
+	int scnt, pcnt, cnt;
+	int i, j, t;
+	if (!otf_in(gvar, 0, 20) || g >= U16(gvar, 12))
+		return;
+	nax = U16(gvar, 4);
+	nshared = U16(gvar, 6);
+	shared = gvar + U32(gvar, 8);
+	lng = U16(gvar, 14) & 1;
+	if (!otf_in(gvar, 20, (g + 2) * (lng ? 4 : 2)) ||
+			!otf_in(shared, 0, 2L * nax * nshared))
+		return;
+	beg = lng ? U32(gvar, 20 + 4 * g) : U16(gvar, 20 + 2 * g) * 2L;
+	end = lng ? U32(gvar, 24 + 4 * g) : U16(gvar, 22 + 2 * g) * 2L;
+	gd = gvar + U32(gvar, 16) + beg;
+	if (beg + 4 > end || !otf_in(gd, 0, end - beg))
+		return;
+	lim = gd + (end - beg);
+	ntup = U16(gd, 0) & 0x0fff;
+	hdr = gd + 4;
+	ser = gd + U16(gd, 2);
+	spts = malloc((n + 1) * sizeof(spts[0]) * 2);
+	ppts = spts + n + 1;
+	touched = malloc(n * sizeof(touched[0]));
+	dx = malloc(n * 6 * sizeof(dx[0]));
+	dy = dx + n;
+	ox = dy + n;
+	oy = ox + n;
+	vx = oy + n;
+	vy = vx + n;
+	memcpy(ox, x, n * sizeof(x[0]));
+	memcpy(oy, y, n * sizeof(y[0]));
+	scnt = -1;
+	if (U16(gd, 0) & 0x8000) {
+		ser = gvar_points(ser, lim, spts, &scnt, n);
+	}
+	for (t = 0; t < ntup; t++) {
+		void *peak, *rbeg = NULL, *rend = NULL;
+		void *data = ser;
+		int sz, idx;
+		double scl;
+		if (hdr + 4 > lim)
+			break;
+		sz = U16(hdr, 0);
+		idx = U16(hdr, 2);
+		hdr += 4;
+		if (idx & 0x8000) {
+			peak = hdr;
+			hdr += 2 * nax;
+		} else {
+			peak = shared + 2 * nax * ((idx & 0x0fff) % MAX(1, nshared));
+		}
+		if (idx & 0x4000) {
+			rbeg = hdr;
+			rend = hdr + 2 * nax;
+			hdr += 4 * nax;
+		}
+		ser += sz;
+		if (hdr > lim || ser > lim)
+			break;
+		if (!(idx & 0x8000) && (idx & 0x0fff) >= nshared)
+			continue;
+		scl = var_region(rbeg, peak, rend, 2, nax);
+		if (scl == 0)
+			continue;
+		pts = spts;
+		cnt = scnt;
+		if (idx & 0x2000) {
+			data = gvar_points(data, ser, ppts, &pcnt, n);
+			pts = ppts;
+			cnt = pcnt;
+		}
+		if (cnt < 0) {
+			data = gvar_deltas(data, ser, dx, n);
+			gvar_deltas(data, ser, dy, n);
+			for (i = 0; i < n; i++) {
+				x[i] += dx[i] * scl;
+				y[i] += dy[i] * scl;
+			}
+			continue;
+		}
+		/* deltas of the given points; the rest are interpolated */
+		data = gvar_deltas(data, ser, vx, cnt);
+		gvar_deltas(data, ser, vy, cnt);
+		memset(touched, 0, n * sizeof(touched[0]));
+		for (i = 0; i < n; i++)
+			dx[i] = dy[i] = 0;
+		for (i = 0; i < cnt; i++) {
+			if (pts[i] < n) {
+				dx[pts[i]] = vx[i];
+				dy[pts[i]] = vy[i];
+				touched[pts[i]] = 1;
+			}
+		}
+		for (i = 0, j = 0; i < nc; i++) {
+			gvar_iup(ox, dx, touched, j, ends[i]);
+			gvar_iup(oy, dy, touched, j, ends[i]);
+			j = ends[i] + 1;
+		}
+		for (i = 0; i < n; i++) {
+			x[i] += dx[i] * scl;
+			y[i] += dy[i] * scl;
+		}
+	}
+	free(spts);
+	free(touched);
+	free(dx);
+}
+
+/* glyph components */
+struct gvcomp {
+	int g;			/* component glyph */
+	int flags;		/* component flags */
+	int arg1, arg2;		/* offset or matching points */
+	double m[4];		/* transformation matrix */
+};
+
+static long gv_budget;		/* the number of component lookups left */
+
+/* the horizontal metrics of glyph g */
+static void gv_hmet(int g, int *adv, int *lsb)
+{
+	int nh = gv_nhmtx;
+	*adv = 0;
+	*lsb = 0;
+	if (nh <= 0)
+		return;
+	*adv = U16(gv_hmtx, 4 * MIN(g, nh - 1));
+	if (g < nh)
+		*lsb = S16(gv_hmtx, 4 * g + 2);
+	else if (otf_in(gv_hmtx, 4 * nh + 2 * (g - nh), 2))
+		*lsb = S16(gv_hmtx, 4 * nh + 2 * (g - nh));
+}
+
+/* read the points of a simple glyph; return nonzero on errors */
+static int glyf_simple(void *p, void *lim, double *x, double *y, int n)
+{
+	void *d;
+	int nc = S16(p, 0);
+	int i, j;
+	if (p + 12 + 2 * nc > lim)
+		return 1;
+	d = p + 12 + 2 * nc + U16(p, 10 + 2 * nc);
+	/* point flags; stored in x and y temporarily */
+	for (i = 0; i < n; ) {
+		int f, rep = 0;
+		if (d + 1 > lim)
+			return 1;
+		f = U8(d, 0);
+		if ((f & 8) && d + 2 > lim)
+			return 1;
+		if (f & 8)
+			rep = U8(d, 1);
+		d += f & 8 ? 2 : 1;
+		for (j = 0; j <= rep && i < n; j++)
+			x[i++] = f;
+	}
+	for (i = 0; i < n; i++)
+		y[i] = x[i];
+	for (i = 0; i < n; i++) {
+		int f = x[i];
+		int sz = f & 2 ? 1 : (f & 16 ? 0 : 2);
+		double v = 0;
+		if (d + sz > lim)
+			return 1;
+		if (sz == 1)
+			v = f & 16 ? U8(d, 0) : -U8(d, 0);
+		if (sz == 2)
+			v = S16(d, 0);
+		x[i] = (i ? x[i - 1] : 0) + v;
+		d += sz;
+	}
+	for (i = 0; i < n; i++) {
+		int f = y[i];
+		int sz = f & 4 ? 1 : (f & 32 ? 0 : 2);
+		double v = 0;
+		if (d + sz > lim)
+			return 1;
+		if (sz == 1)
+			v = f & 32 ? U8(d, 0) : -U8(d, 0);
+		if (sz == 2)
+			v = S16(d, 0);
+		y[i] = (i ? y[i - 1] : 0) + v;
+		d += sz;
+	}
+	return 0;
+}
+
+/* read the components of a composite glyph; return their number */
+static int glyf_comps(void *p, void *lim, struct gvcomp *comps)
+{
+	void *q = p + 10;
+	int n = 0;
+	int fl;
+	do {
+		struct gvcomp *c = &comps[n];
+		int asz, ssz;
+		if (q + 4 > lim)
+			break;
+		fl = U16(q, 0);
+		asz = fl & 1 ? 4 : 2;
+		ssz = fl & 8 ? 2 : (fl & 0x40 ? 4 : (fl & 0x80 ? 8 : 0));
+		if (q + 4 + asz + ssz > lim)
+			break;
+		c->flags = fl;
+		c->g = U16(q, 2);
+		if (fl & 1) {
+			c->arg1 = fl & 2 ? S16(q, 4) : U16(q, 4);
+			c->arg2 = fl & 2 ? S16(q, 6) : U16(q, 6);
+		} else {
+			c->arg1 = fl & 2 ? (signed char) U8(q, 4) : U8(q, 4);
+			c->arg2 = fl & 2 ? (signed char) U8(q, 5) : U8(q, 5);
+		}
+		q += 4 + asz;
+		c->m[0] = c->m[3] = 1;
+		c->m[1] = c->m[2] = 0;
+		if (fl & 8)
+			c->m[0] = c->m[3] = S16(q, 0) / 16384.0;
+		if (fl & 0x40) {
+			c->m[0] = S16(q, 0) / 16384.0;
+			c->m[3] = S16(q, 2) / 16384.0;
+		}
+		if (fl & 0x80) {
+			c->m[0] = S16(q, 0) / 16384.0;
+			c->m[1] = S16(q, 2) / 16384.0;
+			c->m[2] = S16(q, 4) / 16384.0;
+			c->m[3] = S16(q, 6) / 16384.0;
+		}
+		q += ssz;
+		n++;
+	} while (fl & 0x20);
+	return n;
+}
+
+/*
+ * Instance the outline of glyph g: write at most max of its points
+ * to x and y and return their number.  The instanced advance width,
+ * obtained from its phantom points, is stored in adv.
+ */
+static int glyf_inst(int g, double *x, double *y, int max, int depth, int *adv)
+{
+	void *p = gv_glyf + gv_off[g];
+	void *lim = gv_glyf + gv_off[g + 1];
+	struct gvcomp *comps = NULL;
+	double *px, *py;	/* glyph points followed by phantom points */
+	int *ends;		/* contour end points */
+	int n = 0, nc = 0, cnt = 0;
+	int hadv, lsb;
+	int i, j, k;
+	if (gv_off[g] + 10 > gv_off[g + 1])
+		lim = p;
+	if (p + 10 <= lim && S16(p, 0) >= 0) {
+		nc = S16(p, 0);
+		if (p + 10 + 2 * nc > lim)
+			nc = 0;
+		if (nc > 0)
+			n = U16(p, 10 + 2 * (nc - 1)) + 1;
+	}
+	if (p + 10 <= lim && S16(p, 0) < 0) {
+		comps = malloc((lim - p) / 6 * sizeof(comps[0]));
+		nc = glyf_comps(p, lim, comps);
+		n = nc;
+	}
+	px = malloc((n + 4) * sizeof(px[0]));
+	py = malloc((n + 4) * sizeof(py[0]));
+	ends = malloc((nc + 4) * sizeof(ends[0]));
+	for (i = 0; i < nc; i++) {
+		ends[i] = comps ? i : U16(p, 10 + 2 * i);
+		ends[i] = MAX(i ? ends[i - 1] : 0, MIN(n - 1, ends[i]));
+	}
+	if (!comps && glyf_simple(p, lim, px, py, n))
+		n = nc = 0;
+	for (i = 0; comps && i < n; i++) {
+		px[i] = comps[i].flags & 2 ? comps[i].arg1 : 0;
+		py[i] = comps[i].flags & 2 ? comps[i].arg2 : 0;
+	}
+	/* phantom points; only the horizontal ones are used */
+	gv_hmet(g, &hadv, &lsb);
+	px[n] = (p + 10 <= lim ? S16(p, 2) : 0) - lsb;
+	px[n + 1] = px[n] + hadv;
+	px[n + 2] = px[n + 3] = 0;
+	py[n] = py[n + 1] = py[n + 2] = py[n + 3] = 0;
+	for (i = 0; i < 4; i++)
+		ends[nc + i] = n + i;
+	if (gv_gvar)
+		gvar_glyph(g, px, py, n + 4, ends, nc + 4);
+	for (i = 0; i < n + 4; i++) {
+		px[i] = iround(px[i]);
+		py[i] = iround(py[i]);
+	}
+	if (adv)
+		*adv = MAX(0, px[n + 1] - px[n]);
+	for (i = 0; !comps && i < n && cnt < max; i++) {
+		x[cnt] = px[i];
+		y[cnt] = py[i];
+		cnt++;
+	}
+	for (i = 0; comps && i < n && depth < 8 && gv_budget > 0; i++) {
+		struct gvcomp *c = &comps[i];
+		double dx = px[i], dy = py[i], tx;
+		gv_budget--;
+		if (c->g >= gv_n)
+			continue;
+		k = glyf_inst(c->g, x + cnt, y + cnt, max - cnt, depth + 1, NULL);
+		for (j = cnt; j < cnt + k; j++) {
+			tx = c->m[0] * x[j] + c->m[2] * y[j];
+			y[j] = c->m[1] * x[j] + c->m[3] * y[j];
+			x[j] = tx;
+		}
+		if (!(c->flags & 2)) {		/* matching points */
+			dx = 0;
+			dy = 0;
+			if (c->arg1 < cnt && c->arg2 < k) {
+				dx = x[c->arg1] - x[cnt + c->arg2];
+				dy = y[c->arg1] - y[cnt + c->arg2];
+			}
+		} else if ((c->flags & 0x800) && !(c->flags & 0x1000)) {
+			tx = c->m[0] * dx + c->m[2] * dy;
+			dy = c->m[1] * dx + c->m[3] * dy;
+			dx = tx;
 		}
+		for (j = cnt; j < cnt + k; j++) {
+			x[j] += dx;
+			y[j] += dy;
+		}
+		cnt += k;
 	}
+	free(px);
+	free(py);
+	free(ends);
+	free(comps);
+	return cnt;
+}
+
+/* the bounding boxes and advance widths of the instance */
+static void otf_glyfvar(struct otf *otf, void *glyf, u32 *off, int n)
+{
+	void *hhea = otf_table(otf, "hhea");
+	double *x, *y;
+	double bbox[4];
+	int i, j, cnt;
+	gv_glyf = glyf;
+	gv_off = off;
+	gv_n = n;
+	gv_gvar = otf_table(otf, "gvar");
+	gv_hmtx = otf_table(otf, "hmtx");
+	gv_nhmtx = gv_hmtx && hhea ? U16(hhea, 34) : 0;
+	gv_nhmtx = MIN(gv_nhmtx, otf_tablen(otf, "hmtx") / 4);
+	x = malloc(NPTS * sizeof(x[0]));
+	y = malloc(NPTS * sizeof(y[0]));
+	for (i = 0; i < n && i < NGLYPHS; i++) {
+		gv_budget = NPTS;
+		cnt = glyf_inst(i, x, y, NPTS, 0, &glyph_vwid[i]);
+		for (j = 0; j < cnt; j++) {
+			if (!j) {
+				bbox[0] = bbox[2] = x[j];
+				bbox[1] = bbox[3] = y[j];
+			}
+			bbox[0] = MIN(bbox[0], x[j]);
+			bbox[1] = MIN(bbox[1], y[j]);
+			bbox[2] = MAX(bbox[2], x[j]);
+			bbox[3] = MAX(bbox[3], y[j]);
+		}
+		for (j = 0; j < 4; j++)
+			glyph_bbox[i][j] = cnt ? iround(bbox[j]) : 0;
+	}
+	free(x);
+	free(y);
 }
 
 static void otf_glyf(struct otf *otf, void *glyf)
@@ -196,25 +1390,63 @@ static void otf_glyf(struct otf *otf, void *glyf)
 	void *maxp = otf_table(otf, "maxp");
 	void *head = otf_table(otf, "head");
 	void *loca = otf_table(otf, "loca");
-	void *gdat;
-	void *gdat_next;
-	int n = U16(maxp, 4);
-	int fmt = U16(head, 50);
+	long glen = otf_tablen(otf, "glyf");
+	u32 *off;		/* glyph offsets */
+	int n, fmt;
 	int i, j;
+	if (!maxp || !head || !loca)
+		return;
+	n = U16(maxp, 4);
+	fmt = U16(head, 50);
 	if (!glyph_n)
 		glyph_n = n;
+	if ((n + 1) * (fmt ? 4 : 2) > otf_tablen(otf, "loca"))
+		n = otf_tablen(otf, "loca") / (fmt ? 4 : 2) - 1;
+	if (n < 0)
+		return;
+	off = malloc((n + 1) * sizeof(off[0]));
+	if (fmt) {
+		otf_u32s(off, loca, n + 1);
+	} else {
+		otf_u16s((int *) off, loca, n + 1, 2);
+		for (i = 0; i <= n; i++)
+			off[i] *= 2;
+	}
 	for (i = 0; i < n; i++) {
-		if (fmt) {
-			gdat = glyf + U32(loca, 4 * i);
-			gdat_next = glyf + U32(loca, 4 * (i + 1));
-		} else {
-			gdat = glyf + U16(loca, 2 * i) * 2;
-			gdat_next = glyf + U16(loca, 2 * (i + 1)) * 2;
-		}
-		if (gdat < gdat_next)
+		if (off[i] < off[i + 1] && (long) off[i] + 10 <= glen)
 			for (j = 0; j < 4; j++)
-				glyph_bbox[i][j] = S16(gdat, 2 + 2 * j);
+				glyph_bbox[i][j] = S16(glyf, off[i] + 2 + 2 * j);
+	}
+	/* instancing needs glyph outlines */
+	for (i = n; i >= 0; i--)
+		off[i] = MIN(off[i], i < n ? off[i + 1] : glen);
+	if (var_n)
+		otf_glyfvar(otf, glyf, off, n);
+	free(off);
+}
+
+/* instanced advance widths */
+static void otf_hvar(struct otf *otf, void *hvar)
+{
+	struct ivs vs;
+	void *map = NULL;
+	int outer, inner;
+	int i;
+	if (!hvar || !otf_in(hvar, 0, 20)) {
+		/* from the phantom points of glyf outlines */
+		if (otf_table(otf, "gvar") && otf_table(otf, "glyf"))
+			for (i = 0; i < glyph_n && i < gv_n; i++)
+				glyph_wid[i] = glyph_vwid[i];
+		return;
+	}
+	if (U32(hvar, 8))
+		map = hvar + U32(hvar, 8);
+	ivs_init(&vs, hvar + U32(hvar, 4));
+	for (i = 0; i < glyph_n; i++) {
+		ivs_map(map, i, &outer, &inner);
+		glyph_wid[i] += iround(ivs_delta(&vs, outer, inner));
 	}
+	ivs_done(&vs);
 }
 
 static void otf_hmtx(struct otf *otf, void *hmtx)
@@ -222,52 +1454,54 @@ static void otf_hmtx(struct otf *otf, void *hmtx)
 	void *hhea = otf_table(otf, "hhea");
 	int n;
 	int i;
+	if (!hhea || !hmtx)
+		return;
 	n = U16(hhea, 34);
-	for (i = 0; i < n; i++)
-		glyph_wid[i] = U16(hmtx, i * 4);
-	for (i = n; i < glyph_n; i++)
+	if (n * 4 > otf_tablen(otf, "hmtx"))
+		n = otf_tablen(otf, "hmtx") / 4;
+	otf_u16s(glyph_wid, hmtx, n, 4);
+	for (i = n; i < glyph_n && n > 0; i++)
 		glyph_wid[i] = glyph_wid[n - 1];
+	if (var_n)
+		otf_hvar(otf, otf_table(otf, "HVAR"));
 }
 
-static void otf_kern(struct otf *otf, void *kern)
-{
-	int off = 4;
-	int i, j;
-	int n = U16(kern, 2);		/* number of kern subtables */
-	for (i = 0; i < n; i++) {
-		void *tab = kern + off;	/* a kern subtable */
-		int cov = U16(tab, 4);
-		off += U16(tab, 2);
-		if ((cov >> 8) == 0 && (cov & 1)) {	/* format 0 */
-			int npairs = U16(tab, 6);
-			for (j = 0; j < npairs; j++) {
-				int c1 = U16(tab, 14 + 6 * j);
-				int c2 = U16(tab, 14 + 6 * j + 2);
-				int val = S16(tab, 14 + 6 * j + 4);
-				mkfn_kern(glyph_name[c1], glyph_name[c2],
-					uwid(val));
-			}
-		}
-	}
-}
+static int ggrp_make(int *src, int n);
+static int ggrp_has(int id, int g);
+static int ggrp_covtab(void *tab);
+static int ggrp_meet(int id1, int id2);
+static int ggrp_size(int id);
+
 
 static int *coverage(void *cov, int *ncov)
 {
-	int fmt = U16(cov, 0);
-	int n = U16(cov, 2);
+	int fmt = otf_in(cov, 0, 4) ? U16(cov, 0) : 0;
+	int n = fmt ? U16(cov, 2) : 0;
 	int beg, end;
 	int i, j;
-	int *out = malloc(glyph_n * sizeof(*out));
+	int *out;
 	int cnt = 0;
+	if (fmt == 1 && !otf_in(cov, 4, 2 * n))
+		fmt = 0;
+	if (fmt == 2 && !otf_in(cov, 4, 6 * n))
+		fmt = 0;
+	/* overlapping ranges are invalid; at most NGLYPHS glyphs are read */
+	if (fmt == 2) {
+		for (i = 0; i < n && cnt < NGLYPHS; i++)
+			if (U16(cov, 4 + 6 * i + 2) >= U16(cov, 4 + 6 * i))
+				cnt += U16(cov, 4 + 6 * i + 2) - U16(cov, 4 + 6 * i) + 1;
+	}
+	out = malloc(MIN(fmt == 1 ? n : cnt, NGLYPHS) * sizeof(*out) + 1);
+	cnt = 0;
 	if (fmt == 1) {
-		for (i = 0; i < n; i++)
-			out[cnt++] = U16(cov, 4 + 2 * i);
+		otf_u16s(out, cov + 4, n, 2);
+		cnt = n;
 	}
 	if (fmt == 2) {
 		for (i = 0; i < n; i++) {
 			beg = U16(cov, 4 + 6 * i);
 			end = U16(cov, 4 + 6 * i + 2);
-			for (j = beg; j <= end; j++)
+			for (j = beg; j <= end && cnt < NGLYPHS; j++)
 				out[cnt++] = j;
 		}
 	}
@@ -278,23 +1512,22 @@ static int *coverage(void *cov, int *ncov)
 
 static int classdef(void *tab, int *gl, int *cls)
 {
-	int fmt = U16(tab, 0);
+	int fmt = otf_in(tab, 0, 4) ? U16(tab, 0) : 0;
 	int ngl = 0;
 	int i, j;
-	if (fmt == 1) {
+	if (fmt == 1 && otf_in(tab, 0, 6) && otf_in(tab, 6, 2 * U16(tab, 4))) {
 		int beg = U16(tab, 2);
-		ngl = U16(tab, 4);
-		for (i = 0; i < ngl; i++) {
+		ngl = MAX(0, MIN(U16(tab, 4), NGLYPHS - beg));
+		otf_u16s(cls, tab + 6, ngl, 2);
+		for (i = 0; i < ngl; i++)
 			gl[i] = beg + i;
-			cls[i] = U16(tab, 6 + 2 * i);
-		}
 	}
-	if (fmt == 2) {
+	if (fmt == 2 && otf_in(tab, 4, 6 * U16(tab, 2))) {
 		int n = U16(tab, 2);
 		for (i = 0; i < n; i++) {
 			int beg = U16(tab, 4 + 6 * i);
 			int end = U16(tab, 4 + 6 * i + 2);
-			for (j = beg; j <= end; j++) {
+			for (j = beg; j <= end && ngl < NGLYPHS; j++) {
 				gl[ngl] = j;
 				cls[ngl] = U16(tab, 4 + 6 * i + 4);
 				ngl++;
@@ -304,12 +1537,6 @@ static int classdef(void *tab, int *gl, int *cls)
 	return ngl;
 }
 
-static int intcmp(void *v1, void *v2)
-{
-	return *(int *) v1 - *(int *) v2;
-}
-
-static int ggrp_make(int *src, int n);
 
 static int ggrp_class(int *src, int *cls, int nsrc, int id)
 {
@@ -332,6 +1559,176 @@ static int ggrp_coverage(int *g, int n)
 	return ggrp_make(g, n);
 }
 
+/* return the class of glyph g in a class definition table */
+static int classdef_get(void *tab, int g)
+{
+	int fmt = otf_in(tab, 0, 4) ? U16(tab, 0) : 0;
+	int l, h, m;
+	if (fmt == 1 && otf_in(tab, 0, 6) && g >= U16(tab, 2) &&
+			g - U16(tab, 2) < U16(tab, 4) &&
+			otf_in(tab, 6 + 2 * (g - U16(tab, 2)), 2))
+		return U16(tab, 6 + 2 * (g - U16(tab, 2)));
+	if (fmt == 2 && otf_in(tab, 4, 6 * U16(tab, 2))) {
+		l = 0;
+		h = U16(tab, 2);
+		while (l < h) {
+			m = (l + h) / 2;
+			if (g < U16(tab, 4 + 6 * m))
+				h = m;
+			else if (g > U16(tab, 4 + 6 * m + 2))
+				l = m + 1;
+			else
+				return U16(tab, 4 + 6 * m + 4);
+		}
+	}
+	return 0;
+}
+
+/* GDEF glyph classes, mark sets, and the flags of the current lookup */
+static u8 gdef_cls[NGLYPHS];	/* glyph classes: base, ligature, mark, component */
+static u8 gdef_mcls[NGLYPHS];	/* mark attachment classes */
+static u8 gdef_mset[NGLYPHS];	/* the glyphs of mark filtering set gdef_set */
+static void *gdef_sets;		/* mark glyph sets definition table */
+static int gdef_set = -1;	/* the mark filtering set of the current lookup */
+static int gdef_flag;		/* the flags of the current lookup */
+static void *gdef_cur;		/* the current lookup */
+
+/* read the glyph classes and the mark glyph sets of the GDEF table */
+static void otf_gdef(struct otf *otf, void *gdef)
+{
+	int *gl = malloc(NGLYPHS * sizeof(gl[0]));
+	int *cls = malloc(NGLYPHS * sizeof(cls[0]));
+	int i, n;
+	memset(gdef_cls, 0, sizeof(gdef_cls));
+	memset(gdef_mcls, 0, sizeof(gdef_mcls));
+	gdef_sets = NULL;
+	gdef_set = -1;
+	if (gdef && otf_in(gdef, 0, 12) && U16(gdef, 4)) {
+		n = classdef(gdef + U16(gdef, 4), gl, cls);
+		for (i = 0; i < n; i++)
+			gdef_cls[gl[i]] = cls[i] <= 4 ? cls[i] : 0;
+	}
+	if (gdef && otf_in(gdef, 0, 12) && U16(gdef, 10)) {
+		n = classdef(gdef + U16(gdef, 10), gl, cls);
+		for (i = 0; i < n; i++)
+			gdef_mcls[gl[i]] = cls[i] < 256 ? cls[i] : 0;
+	}
+	if (gdef && U16(gdef, 2) >= 2 && otf_in(gdef, 0, 14) && U16(gdef, 12)) {
+		void *sets = gdef + U16(gdef, 12);
+		if (otf_in(sets, 0, 4) && U16(sets, 0) == 1 &&
+				otf_in(sets, 4, 4 * U16(sets, 2)))
+			gdef_sets = sets;
+	}
+	free(gl);
+	free(cls);
+}
+
+/* use the flags of the given lookup in gdef_skip(); return the previous one */
+static void *gdef_lookup(void *lookup)
+{
+	void *prev = gdef_cur;
+	int set = -1;
+	int *cov;
+	int i, ncov;
+	gdef_cur = lookup;
+	gdef_flag = lookup ? U16(lookup, 2) : 0;
+	if (gdef_flag & 0x10) {
+		int off = 6 + 2 * U16(lookup, 4);
+		if (gdef_sets && otf_in(lookup, off, 2) &&
+				U16(lookup, off) < U16(gdef_sets, 2))
+			set = U16(lookup, off);
+		else
+			gdef_flag &= ~0x10;
+	}
+	if (set >= 0 && set != gdef_set) {
+		cov = coverage(gdef_sets + U32(gdef_sets, 4 + 4 * set), &ncov);
+		memset(gdef_mset, 0, sizeof(gdef_mset));
+		for (i = 0; i < ncov; i++)
+			gdef_mset[cov[i]] = 1;
+		free(cov);
+		gdef_set = set;
+	}
+	return prev;
+}
+
+/* check if the current lookup ignores glyph g */
+static int gdef_skip(int g)
+{
+	switch (g >= 0 && g < NGLYPHS ? gdef_cls[g] : 0) {
+	case 1:
+		return gdef_flag & 0x2;		/* IgnoreBaseGlyphs */
+	case 2:
+		return gdef_flag & 0x4;		/* IgnoreLigatures */
+	case 3:
+		if (gdef_flag & 0x8)		/* IgnoreMarks */
+			return 1;
+		if (gdef_flag & 0x10)		/* UseMarkFilteringSet */
+			return !gdef_mset[g];
+		return (gdef_flag >> 8) && gdef_mcls[g] != gdef_flag >> 8;
+	}
+	return 0;
+}
+
+/* the glyph groups of the classes of a class definition table */
+struct gcls {
+	int *gl, *cls;		/* glyphs and their classes */
+	int n;			/* number of glyphs in gl[] */
+	int *grp;		/* the group of each class; -2 if not made */
+	int ncls;		/* number of classes */
+};
+
+static void gcls_init(struct gcls *gc, void *tab)
+{
+	int i;
+	gc->gl = malloc(NGLYPHS * sizeof(gc->gl[0]));
+	gc->cls = malloc(NGLYPHS * sizeof(gc->cls[0]));
+	gc->n = classdef(tab, gc->gl, gc->cls);
+	gc->ncls = 1;
+	for (i = 0; i < gc->n; i++)
+		gc->ncls = MAX(gc->ncls, gc->cls[i] + 1);
+	gc->grp = malloc(gc->ncls * sizeof(gc->grp[0]));
+	for (i = 0; i < gc->ncls; i++)
+		gc->grp[i] = -2;
+}
+
+static void gcls_done(struct gcls *gc)
+{
+	free(gc->gl);
+	free(gc->cls);
+	free(gc->grp);
+}
+
+/* return the glyph group of class c, or -1 if it is empty */
+static int gcls_grp(struct gcls *gc, int c)
+{
+	char *mark;
+	int *g;
+	int i, n = 0;
+	if (c >= gc->ncls)
+		return -1;
+	if (gc->grp[c] != -2)
+		return gc->grp[c];
+	if (c > 0) {
+		for (i = 0; i < gc->n && !n; i++)
+			n = gc->cls[i] == c;
+		gc->grp[c] = n ? ggrp_class(gc->gl, gc->cls, gc->n, c) : -1;
+		return gc->grp[c];
+	}
+	/* class zero includes every glyph without a class */
+	mark = calloc(glyph_n + 1, 1);
+	g = malloc((glyph_n + 1) * sizeof(g[0]));
+	for (i = 0; i < gc->n; i++)
+		if (gc->cls[i] && gc->gl[i] < glyph_n)
+			mark[gc->gl[i]] = 1;
+	for (i = 0; i < glyph_n; i++)
+		if (!mark[i])
+			g[n++] = i;
+	gc->grp[0] = n ? ggrp_make(g, n) : -1;
+	free(mark);
+	free(g);
+	return gc->grp[0];
+}
+
 static int valuerecord_len(int fmt)
 {
 	int off = 0;
@@ -342,61 +1739,174 @@ static int valuerecord_len(int fmt)
 	return off;
 }
 
-static void valuerecord_print(int fmt, void *rec)
+/*
+ * Read the placement and advance adjustments of a value record
+ * into vals; return nonzero if any of its values is not smaller
+ * than mkfn_kmin.  The common formats are decoded directly.
+ */
+static int valuerecord(int fmt, void *rec, void *sub, int *vals)
 {
-	int vals[8] = {0};
+	int kmin = MAX(1, mkfn_kmin);
+	int raw[4] = {0};
 	int off = 0;
+	int big = 0;
 	int i;
+	vals[0] = vals[1] = vals[2] = vals[3] = 0;
+	switch (fmt) {
+	case 0x0:
+		return 0;
+	case 0x4:	/* XAdvance */
+		vals[2] = UWID(U16(rec, 0));
+		return abs(vals[2]) >= kmin;
+	case 0x5:	/* XPlacement, XAdvance */
+		vals[0] = UWID(U16(rec, 0));
+		vals[2] = UWID(U16(rec, 2));
+		return abs(vals[0]) >= kmin || abs(vals[2]) >= kmin;
+	case 0x1:	/* XPlacement */
+		vals[0] = UWID(U16(rec, 0));
+		return abs(vals[0]) >= kmin;
+	case 0x3:	/* XPlacement, YPlacement */
+		vals[0] = UWID(U16(rec, 0));
+		vals[1] = UWID(U16(rec, 2));
+		return abs(vals[0]) >= kmin || abs(vals[1]) >= kmin;
+	}
 	for (i = 0; i < 8; i++) {
 		if (fmt & (1 << i)) {
-			vals[i] = uwid(S16(rec, off));
+			int val = UWID(U16(rec, off));
+			if (i < 4) {
+				raw[i] = S16(rec, off);
+				vals[i] = val;
+			}
+			/* device tables vary the values of variable fonts */
+			if (i >= 4 && var_n && U16(rec, off) && (fmt & (1 << (i - 4)))) {
+				vals[i - 4] = uwid(raw[i - 4] +
+					var_device(sub + U16(rec, off)));
+				big = big || abs(vals[i - 4]) >= kmin;
+			}
+			big = big || abs(val) >= kmin;
 			off += 2;
 		}
 	}
+	return big;
+}
+
+/* the x or y coordinate of an anchor table */
+static int otf_anchor(void *anc, int y)
+{
+	int val = S16(anc, y ? 4 : 2);
+	if (var_n && U16(anc, 0) == 3 && otf_in(anc, 0, 10) && U16(anc, y ? 8 : 6))
+		val += var_device(anc + U16(anc, y ? 8 : 6));
+	return val;
+}
+
+static void valuerecord_print(int fmt, int *vals)
+{
 	if (fmt)
 		printf(":%+d%+d%+d%+d", vals[0], vals[1], vals[2], vals[3]);
 }
 
-static int valuerecord_small(int fmt, void *rec)
+/*
+ * The decoded rules of a lookup nested in contexts.  For substitutions,
+ * src[] and dst[] are the replaced and inserted glyphs; for positioning,
+ * src[] are the glyphs or groups and dst[] their adjustments (4 for each
+ * entry).  Entries of src[] are groups or glyphs ORed with GCTXGLYPH.
+ * The rule starts at off positions after the sequence index of the
+ * lookup record.
+ */
+struct glookup {
+	int *rules;		/* rules: nsrc, ndst, off, src[nsrc], dst[ndst] */
+	int n, sz;		/* used and allocated length of rules[] */
+	int done;		/* the lookup is decoded */
+};
+
+/* mark attachments depend on the direction; r2l copies follow the l2r ones */
+static struct glookup *glookups;	/* nested lookups of a gsub/gpos table */
+static int glookups_n;			/* number of lookups in glookups[] */
+
+static void glookup_add(struct glookup *gl, int *src, int nsrc, int *dst, int ndst, int off)
 {
-	int off = 0;
 	int i;
-	for (i = 0; i < 8; i++) {
-		if (fmt & (1 << i)) {
-			if (abs(uwid(S16(rec, off))) >= MAX(1, mkfn_kmin))
-				return 0;
-			off += 2;
-		}
+	if (gl->n + 3 + nsrc + ndst > gl->sz) {
+		if (gl->sz >= NGRULES)
+			return;
+		gl->sz = MAX(gl->sz * 2, gl->n + 3 + nsrc + ndst + 256);
+		gl->rules = realloc(gl->rules, gl->sz * sizeof(gl->rules[0]));
 	}
-	return 1;
+	gl->rules[gl->n++] = nsrc;
+	gl->rules[gl->n++] = ndst;
+	gl->rules[gl->n++] = off;
+	for (i = 0; i < nsrc; i++)
+		gl->rules[gl->n++] = src[i];
+	for (i = 0; i < ndst; i++)
+		gl->rules[gl->n++] = dst[i];
+}
+
+static void glookups_init(void *lookuplist)
+{
+	glookups_n = otf_in(lookuplist, 0, 2) ? U16(lookuplist, 0) : 0;
+	glookups = calloc(2 * glookups_n + 1, sizeof(glookups[0]));
+}
+
+static void glookups_done(void)
+{
+	int i;
+	for (i = 0; i < 2 * glookups_n; i++)
+		free(glookups[i].rules);
+	free(glookups);
+	glookups = NULL;
+	glookups_n = 0;
 }
 
 /* single adjustment positioning */
-static void otf_gpostype1(struct otf *otf, void *sub, char *feat)
+static void otf_gpostype1(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
-	int fmt = U16(sub, 0);
-	int vfmt = U16(sub, 4);
+	int fmt, vfmt;
 	int *cov;
 	int ncov, nvals;
-	int vlen = valuerecord_len(vfmt);
-	int i;
+	int vlen;
+	int vals[4];
+	int i, g;
+	if (!otf_in(sub, 0, 8))
+		return;
+	uwid_init();
+	fmt = U16(sub, 0);
+	vfmt = U16(sub, 4);
+	vlen = valuerecord_len(vfmt);
+	if (fmt == 1 && !otf_in(sub, 6, vlen))
+		return;
+	if (fmt == 2 && !otf_in(sub, 8, U16(sub, 6) * vlen))
+		return;
 	cov = coverage(sub + U16(sub, 2), &ncov);
 	if (fmt == 1) {
 		for (i = 0; i < ncov; i++) {
-			if (valuerecord_small(vfmt, sub + 6))
+			if (gdef_skip(cov[i]))
+				continue;
+			if (!valuerecord(vfmt, sub + 6, sub, vals))
 				continue;
+			if (gl) {
+				g = cov[i] | GCTXGLYPH;
+				glookup_add(gl, &g, 1, vals, 4, 0);
+				continue;
+			}
 			printf("1 %s", gname(cov[i]));
-			valuerecord_print(vfmt, sub + 6);
+			valuerecord_print(vfmt, vals);
 			printf("\n");
 		}
 	}
 	if (fmt == 2) {
 		nvals = U16(sub, 6);
-		for (i = 0; i < nvals; i++) {
-			if (valuerecord_small(vfmt, sub + 6))
+		for (i = 0; i < nvals && i < ncov; i++) {
+			if (gdef_skip(cov[i]))
+				continue;
+			if (!valuerecord(vfmt, sub + 8 + i * vlen, sub, vals))
 				continue;
+			if (gl) {
+				g = cov[i] | GCTXGLYPH;
+				glookup_add(gl, &g, 1, vals, 4, 0);
+				continue;
+			}
 			printf("1 %s", gname(cov[i]));
-			valuerecord_print(vfmt, sub + 8 + i * vlen);
+			valuerecord_print(vfmt, vals);
 			printf("\n");
 		}
 	}
@@ -404,60 +1914,121 @@ static void otf_gpostype1(struct otf *otf, void *sub, char *feat)
 }
 
 /* pair adjustment positioning */
-static void otf_gpostype2(struct otf *otf, void *sub, char *feat)
+static void otf_gpostype2(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
-	int fmt = U16(sub, 0);
-	int vfmt1 = U16(sub, 4);	/* valuerecord 1 */
-	int vfmt2 = U16(sub, 6);	/* valuerecord 2 */
+	int fmt, vfmt1, vfmt2;		/* format and valuerecords 1 and 2 */
 	int fmtoff1, fmtoff2;
-	int vrlen;			/* the length of vfmt1 and vfmt2 */
-	int i, j;
-	vrlen = valuerecord_len(vfmt1) + valuerecord_len(vfmt2);
-	if (fmt == 1) {
+	int vlen1, vrlen;		/* the length of vfmt1 and vfmt1 + vfmt2 */
+	int vals[8];			/* the values of both glyphs */
+	int *vals1 = vals, *vals2 = vals + 4;
+	int ent[2];
+	int big1, big2;
+	int i, j, k;
+	if (!otf_in(sub, 0, 10))
+		return;
+	uwid_init();
+	fmt = U16(sub, 0);
+	vfmt1 = U16(sub, 4);
+	vfmt2 = U16(sub, 6);
+	vlen1 = valuerecord_len(vfmt1);
+	vrlen = vlen1 + valuerecord_len(vfmt2);
+	if (fmt == 1 && otf_in(sub, 10, 2 * U16(sub, 8))) {
 		int nc1 = U16(sub, 8);
-		int *cov = coverage(sub + U16(sub, 2), NULL);
-		for (i = 0; i < nc1; i++) {
+		int ncov;
+		int *cov = coverage(sub + U16(sub, 2), &ncov);
+		for (i = 0; i < nc1 && i < ncov; i++) {
 			void *c2 = sub + U16(sub, 10 + 2 * i);
-			int nc2 = U16(c2, 0);
+			int nc2;
+			if (!otf_in(c2, 0, 2) || !otf_in(c2, 2, (2 + vrlen) * U16(c2, 0)))
+				continue;
+			if (gdef_skip(cov[i]))
+				continue;
+			nc2 = U16(c2, 0);
 			for (j = 0; j < nc2; j++) {
 				int second = U16(c2 + 2 + (2 + vrlen) * j, 0);
+				if (gdef_skip(second))
+					continue;
 				fmtoff1 = 2 + (2 + vrlen) * j + 2;
-				fmtoff2 = fmtoff1 + valuerecord_len(vfmt1);
-				if (valuerecord_small(vfmt1, c2 + fmtoff1) &&
-					valuerecord_small(vfmt2, c2 + fmtoff2))
+				fmtoff2 = fmtoff1 + vlen1;
+				big1 = valuerecord(vfmt1, c2 + fmtoff1, c2, vals1);
+				big2 = valuerecord(vfmt2, c2 + fmtoff2, c2, vals2);
+				if (!big1 && !big2)
+					continue;
+				if (gl) {
+					ent[0] = cov[i] | GCTXGLYPH;
+					ent[1] = second | GCTXGLYPH;
+					glookup_add(gl, ent, 2, vals, 8, 0);
 					continue;
+				}
 				printf("2 %s", gname(cov[i]));
-				valuerecord_print(vfmt1, c2 + fmtoff1);
+				valuerecord_print(vfmt1, vals1);
 				printf(" %s", gname(second));
-				valuerecord_print(vfmt2, c2 + fmtoff2);
+				valuerecord_print(vfmt2, vals2);
 				printf("\n");
 			}
 		}
 		free(cov);
 	}
-	if (fmt == 2) {
+	if (fmt == 2 && otf_in(sub, 0, 16) &&
+			otf_in(sub, 16, (long) U16(sub, 12) * U16(sub, 14) * vrlen)) {
 		static int gl1[NGLYPHS], gl2[NGLYPHS];
 		static int cls1[NGLYPHS], cls2[NGLYPHS];
 		static int grp1[NGLYPHS], grp2[NGLYPHS];
-		int ngl1 = classdef(sub + U16(sub, 8), gl1, cls1);
-		int ngl2 = classdef(sub + U16(sub, 10), gl2, cls2);
+		static int cnt1[NGLYPHS], cnt2[NGLYPHS];
 		int ncls1 = U16(sub, 12);
 		int ncls2 = U16(sub, 14);
-		for (i = 0; i < ncls1; i++)
-			grp1[i] = ggrp_class(gl1, cls1, ngl1, i);
-		for (i = 0; i < ncls2; i++)
-			grp2[i] = ggrp_class(gl2, cls2, ngl2, i);
+		int ngl1, ngl2;
+		int *cov = coverage(sub + U16(sub, 2), &ngl1);
+		/* the first glyphs are covered; class 0 holds the unlisted ones */
+		for (k = 0; k < ngl1; k++) {
+			gl1[k] = cov[k];
+			cls1[k] = classdef_get(sub + U16(sub, 8), cov[k]);
+		}
+		free(cov);
+		ngl2 = classdef(sub + U16(sub, 10), gl2, cls2);
+		/* groups are made only when a rule uses them */
 		for (i = 0; i < ncls1; i++) {
+			grp1[i] = -1;
+			cnt1[i] = 0;
+		}
+		for (i = 0; i < ncls2; i++) {
+			grp2[i] = -1;
+			cnt2[i] = 0;
+		}
+		for (k = 0; k < ngl1; k++)
+			if (cls1[k] < ncls1 && !gdef_skip(gl1[k]))
+				cnt1[cls1[k]]++;
+		for (k = 0; k < ngl2; k++)
+			if (cls2[k] < ncls2 && !gdef_skip(gl2[k]))
+				cnt2[cls2[k]]++;
+		/* nested rules start with the covered glyphs, not their classes */
+		for (k = 0; k < (gl ? ngl1 : ncls1); k++) {
+			i = gl ? cls1[k] : k;
+			if (i >= ncls1 || !cnt1[i] || (gl && gdef_skip(gl1[k])))
+				continue;
 			for (j = 0; j < ncls2; j++) {
+				if (!cnt2[j])
+					continue;
 				fmtoff1 = 16 + (i * ncls2 + j) * vrlen;
-				fmtoff2 = fmtoff1 + valuerecord_len(vfmt1);
-				if (valuerecord_small(vfmt1, sub + fmtoff1) &&
-					valuerecord_small(vfmt2, sub + fmtoff2))
+				fmtoff2 = fmtoff1 + vlen1;
+				big1 = valuerecord(vfmt1, sub + fmtoff1, sub, vals1);
+				big2 = valuerecord(vfmt2, sub + fmtoff2, sub, vals2);
+				if (!big1 && !big2)
 					continue;
+				if (grp2[j] < 0)
+					grp2[j] = ggrp_class(gl2, cls2, ngl2, j);
+				if (gl) {
+					ent[0] = gl1[k] | GCTXGLYPH;
+					ent[1] = grp2[j];
+					glookup_add(gl, ent, 2, vals, 8, 0);
+					continue;
+				}
+				if (grp1[i] < 0)
+					grp1[i] = ggrp_class(gl1, cls1, ngl1, i);
 				printf("2 @%d", grp1[i]);
-				valuerecord_print(vfmt1, sub + fmtoff1);
+				valuerecord_print(vfmt1, vals1);
 				printf(" @%d", grp2[j]);
-				valuerecord_print(vfmt2, sub + fmtoff2);
+				valuerecord_print(vfmt2, vals2);
 				printf("\n");
 			}
 		}
@@ -467,16 +2038,17 @@ static void otf_gpostype2(struct otf *otf, void *sub, char *feat)
 /* cursive attachment positioning */
 static void otf_gpostype3(struct otf *otf, void *sub, char *feat)
 {
-	int fmt = U16(sub, 0);
 	int *cov, *icov, *ocov;
-	int i, n;
+	int i, n, ncov;
 	int icnt = 0;
 	int ocnt = 0;
 	int igrp, ogrp;
-	if (fmt != 1)
+	if (!otf_in(sub, 0, 6) || U16(sub, 0) != 1)
+		return;
+	if (!otf_in(sub, 6, 4 * U16(sub, 4)))
 		return;
-	cov = coverage(sub + U16(sub, 2), NULL);
-	n = U16(sub, 4);
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	n = MIN(U16(sub, 4), ncov);
 	icov = malloc(n * sizeof(icov[0]));
 	ocov = malloc(n * sizeof(ocov[0]));
 	for (i = 0; i < n; i++)
@@ -492,9 +2064,9 @@ static void otf_gpostype3(struct otf *otf, void *sub, char *feat)
 	printf("gsec %d gpos %s\n", sec, feat);
 	for (i = 0; i < n; i++) {
 		int prev = U16(sub, 6 + 4 * i);
-		if (prev) {
-			int dx = -uwid(S16(sub, prev + 2));
-			int dy = -uwid(S16(sub, prev + 4));
+		if (prev && otf_in(sub, prev, 6) && !gdef_skip(cov[i]) && ggrp_size(igrp)) {
+			int dx = -uwid(otf_anchor(sub + prev, 0));
+			int dy = -uwid(otf_anchor(sub + prev, 1));
 			if (otf_r2l(feat))
 				dx += uwid(glyph_wid[cov[i]]);
 			printf("2 @%d %s:%+d%+d%+d%+d\n",
@@ -504,9 +2076,9 @@ static void otf_gpostype3(struct otf *otf, void *sub, char *feat)
 	printf("gsec %d gpos %s\n", sec + 1, feat);
 	for (i = 0; i < n; i++) {
 		int next = U16(sub, 6 + 4 * i + 2);
-		if (next) {
-			int dx = uwid(S16(sub, next + 2)) - uwid(glyph_wid[cov[i]]);
-			int dy = uwid(S16(sub, next + 4));
+		if (next && otf_in(sub, next, 6) && !gdef_skip(cov[i]) && ggrp_size(ogrp)) {
+			int dx = uwid(otf_anchor(sub + next, 0)) - uwid(glyph_wid[cov[i]]);
+			int dy = uwid(otf_anchor(sub + next, 1));
 			if (otf_r2l(feat)) {
 				dx += uwid(glyph_wid[cov[i]]);
 			}
@@ -514,13 +2086,62 @@ static void otf_gpostype3(struct otf *otf, void *sub, char *feat)
 				gname(cov[i]), ogrp, 0, 0, dx, dy);
 		}
 	}
-	free(cov);
+	free(cov);
+}
+
+/* define a glyph group for each class of a mark array */
+static void otf_markgrps(void *marks, int *mcov, int mcnt, int ccnt, int *cgrp)
+{
+	int *grp = malloc((mcnt + 1) * sizeof(grp[0]));
+	int i, j, cnt;
+	for (i = 0; i < ccnt; i++) {
+		cnt = 0;
+		for (j = 0; j < mcnt; j++)
+			if (U16(marks, 2 + 4 * j) == i)
+				grp[cnt++] = mcov[j];
+		cgrp[i] = ggrp_coverage(grp, cnt);
+	}
+	free(grp);
+}
+
+/* the rules of mark-to-base attachment lookups nested in contexts */
+static void otf_gposmarks(void *sub, char *feat, void *marks, void *bases,
+		int *mcov, int mcnt, int *bcov, int bcnt, int ccnt, struct glookup *gl)
+{
+	int ent[2];
+	int adj[8] = {0};
+	int i, j;
+	for (i = 0; i < bcnt; i++) {
+		for (j = 0; j < mcnt; j++) {
+			void *mark = marks + U16(marks, 2 + 4 * j + 2);
+			int cls = U16(marks, 2 + 4 * j);
+			void *base = bases + U16(bases, 2 + ccnt * 2 * i + 2 * cls);
+			if (cls >= ccnt || !otf_in(mark, 0, 6) || !otf_in(base, 0, 6))
+				continue;
+			if (gdef_skip(bcov[i]) || gdef_skip(mcov[j]))
+				continue;
+			adj[4] = uwid(otf_anchor(base, 0)) - uwid(otf_anchor(mark, 0));
+			adj[5] = uwid(otf_anchor(base, 1)) - uwid(otf_anchor(mark, 1));
+			if (otf_r2l(feat)) {
+				adj[4] += uwid(glyph_wid[mcov[j]]);
+				adj[5] = -adj[5];
+			} else {
+				adj[4] -= uwid(glyph_wid[bcov[i]]);
+			}
+			ent[0] = bcov[i] | GCTXGLYPH;
+			ent[1] = mcov[j] | GCTXGLYPH;
+			glookup_add(gl, ent, 2, adj, 8, -1);
+		}
+	}
 }
 
-/* mark-to-base attachment positioning */
-static void otf_gpostype4(struct otf *otf, void *sub, char *feat)
+/*
+ * Mark-to-base (type 4) and mark-to-mark (type 6) attachment
+ * positioning; the base array of the latter lists the anchors of the
+ * marks to which other marks attach.
+ */
+static void otf_gpostype4(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
-	int fmt = U16(sub, 0);
 	int *mcov;		/* mark coverage */
 	int *bcov;		/* base coverage */
 	int cgrp[1024];		/* glyph groups assigned to classes */
@@ -531,31 +2152,38 @@ static void otf_gpostype4(struct otf *otf, void *sub, char *feat)
 	void *marks;		/* mark array table */
 	void *bases;		/* base array table */
 	int i, j;
-	if (fmt != 1)
+	if (!otf_in(sub, 0, 12) || U16(sub, 0) != 1)
 		return;
-	mcov = coverage(sub + U16(sub, 2), &mcnt);
-	bcov = coverage(sub + U16(sub, 4), &bcnt);
 	ccnt = U16(sub, 6);
 	marks = sub + U16(sub, 8);
 	bases = sub + U16(sub, 10);
+	if (ccnt > LEN(cgrp) || !otf_in(marks, 0, 2) || !otf_in(bases, 0, 2))
+		return;
+	mcov = coverage(sub + U16(sub, 2), &mcnt);
+	bcov = coverage(sub + U16(sub, 4), &bcnt);
+	mcnt = MIN(mcnt, U16(marks, 0));
+	bcnt = MIN(bcnt, U16(bases, 0));
+	if (!otf_in(marks, 2, 4 * mcnt) || !otf_in(bases, 2, 2L * ccnt * bcnt))
+		mcnt = bcnt = 0;
+	if (gl) {
+		otf_gposmarks(sub, feat, marks, bases, mcov, mcnt, bcov, bcnt, ccnt, gl);
+		free(mcov);
+		free(bcov);
+		return;
+	}
 	/* define a group for base glyphs */
 	bgrp = ggrp_coverage(bcov, bcnt);
 	/* define a group for each mark class */
-	for (i = 0; i < ccnt; i++) {
-		int *grp = malloc(mcnt * sizeof(grp[0]));
-		int cnt = 0;
-		for (j = 0; j < mcnt; j++)
-			if (U16(marks, 2 + 4 * j) == i)
-				grp[cnt++] = mcov[j];
-		cgrp[i] = ggrp_coverage(grp, cnt);
-		free(grp);
-	}
+	otf_markgrps(marks, mcov, mcnt, ccnt, cgrp);
 	/* GPOS rules for each mark after base glyphs */
 	printf("gsec %d gpos %s\n", sec, feat);
 	for (i = 0; i < mcnt; i++) {
 		void *mark = marks + U16(marks, 2 + 4 * i + 2);	/* mark anchor */
-		int dx = -uwid(S16(mark, 2));
-		int dy = -uwid(S16(mark, 4));
+		int dx, dy;
+		if (!otf_in(mark, 0, 6) || gdef_skip(mcov[i]) || !ggrp_size(bgrp))
+			continue;
+		dx = -uwid(otf_anchor(mark, 0));
+		dy = -uwid(otf_anchor(mark, 1));
 		if (otf_r2l(feat)) {
 			dx += uwid(glyph_wid[mcov[i]]);
 			dy = -dy;
@@ -568,8 +2196,11 @@ static void otf_gpostype4(struct otf *otf, void *sub, char *feat)
 	for (i = 0; i < bcnt; i++) {
 		for (j = 0; j < ccnt; j++) {
 			void *base = bases + U16(bases, 2 + ccnt * 2 * i + 2 * j);
-			int dx = uwid(S16(base, 2)) - uwid(glyph_wid[bcov[i]]);
-			int dy = uwid(S16(base, 4));
+			int dx, dy;
+			if (!otf_in(base, 0, 6) || gdef_skip(bcov[i]) || !ggrp_size(cgrp[j]))
+				continue;
+			dx = uwid(otf_anchor(base, 0)) - uwid(glyph_wid[bcov[i]]);
+			dy = uwid(otf_anchor(base, 1));
 			if (otf_r2l(feat)) {
 				dx += uwid(glyph_wid[bcov[i]]);
 				dy = -dy;
@@ -585,7 +2216,6 @@ static void otf_gpostype4(struct otf *otf, void *sub, char *feat)
 /* mark-to-ligature attachment positioning */
 static void otf_gpostype5(struct otf *otf, void *sub, char *feat)
 {
-	int fmt = U16(sub, 0);
 	int *mcov;		/* mark coverage */
 	int *lcov;		/* ligature coverage */
 	int cgrp[1024];		/* glyph groups assigned to classes */
@@ -597,31 +2227,32 @@ static void otf_gpostype5(struct otf *otf, void *sub, char *feat)
 	void *ligas;		/* ligature array table */
 	int i, j, k;
 	/* only marks at the end of ligatures are supported */
-	if (fmt != 1)
+	if (!otf_in(sub, 0, 12) || U16(sub, 0) != 1)
 		return;
-	mcov = coverage(sub + U16(sub, 2), &mcnt);
-	lcov = coverage(sub + U16(sub, 4), &lcnt);
 	ccnt = U16(sub, 6);
 	marks = sub + U16(sub, 8);
 	ligas = sub + U16(sub, 10);
+	if (ccnt > LEN(cgrp) || !otf_in(marks, 0, 2) || !otf_in(ligas, 0, 2))
+		return;
+	mcov = coverage(sub + U16(sub, 2), &mcnt);
+	lcov = coverage(sub + U16(sub, 4), &lcnt);
+	mcnt = MIN(mcnt, U16(marks, 0));
+	lcnt = MIN(lcnt, U16(ligas, 0));
+	if (!otf_in(marks, 2, 4 * mcnt) || !otf_in(ligas, 2, 2 * lcnt))
+		mcnt = lcnt = 0;
 	/* define a group for ligatures */
 	lgrp = ggrp_coverage(lcov, lcnt);
 	/* define a group for each mark class */
-	for (i = 0; i < ccnt; i++) {
-		int *grp = malloc(mcnt * sizeof(grp[0]));
-		int cnt = 0;
-		for (j = 0; j < mcnt; j++)
-			if (U16(marks, 2 + 4 * j) == i)
-				grp[cnt++] = mcov[j];
-		cgrp[i] = ggrp_coverage(grp, cnt);
-		free(grp);
-	}
+	otf_markgrps(marks, mcov, mcnt, ccnt, cgrp);
 	/* GPOS rules for each mark after a ligature */
 	printf("gsec %d gpos %s\n", sec, feat);
 	for (i = 0; i < mcnt; i++) {
 		void *mark = marks + U16(marks, 2 + 4 * i + 2);	/* mark anchor */
-		int dx = -uwid(S16(mark, 2));
-		int dy = -uwid(S16(mark, 4));
+		int dx, dy;
+		if (!otf_in(mark, 0, 6) || gdef_skip(mcov[i]) || !ggrp_size(lgrp))
+			continue;
+		dx = -uwid(otf_anchor(mark, 0));
+		dy = -uwid(otf_anchor(mark, 1));
 		if (otf_r2l(feat)) {
 			dx += uwid(glyph_wid[mcov[i]]);
 			dy = -dy;
@@ -633,17 +2264,23 @@ static void otf_gpostype5(struct otf *otf, void *sub, char *feat)
 	/* GPOS rules for each ligature before a mark */
 	for (i = 0; i < lcnt; i++) {
 		void *ligattach = ligas + U16(ligas, 2 + 2 * i);
-		int comcnt = U16(ligattach, 0);		/* component count */
+		int comcnt;				/* component count */
+		if (!otf_in(ligattach, 0, 2))
+			continue;
+		comcnt = U16(ligattach, 0);
 		/* considering only the last component */
 		k = comcnt - 1;
-		if (comcnt == 0)
+		if (comcnt == 0 || !otf_in(ligattach, 2, 2L * ccnt * comcnt))
 			continue;
 		if (!U16(ligattach, 2 + 2 * ccnt * k))
 			continue;
 		for (j = 0; j < ccnt; j++) {
 			char *base = ligattach + U16(ligattach, 2 + 2 * ccnt * k + 2 * j);
-			int dx = uwid(S16(base, 2)) - uwid(glyph_wid[lcov[i]]);
-			int dy = uwid(S16(base, 4));
+			int dx, dy;
+			if (!otf_in(base, 0, 6) || gdef_skip(lcov[i]) || !ggrp_size(cgrp[j]))
+				continue;
+			dx = uwid(otf_anchor(base, 0)) - uwid(glyph_wid[lcov[i]]);
+			dy = uwid(otf_anchor(base, 1));
 			if (otf_r2l(feat)) {
 				dx += uwid(glyph_wid[lcov[i]]);
 				dy = -dy;
@@ -656,187 +2293,677 @@ static void otf_gpostype5(struct otf *otf, void *sub, char *feat)
 	free(lcov);
 }
 
-/* gsub context */
+/* gsub/gpos context; its entries are glyph groups or glyphs ORed with GCTXGLYPH */
 struct gctx {
-	int bgrp[GCTXLEN];	/* backtrack coverage arrays */
-	int igrp[GCTXLEN];	/* input coverage arrays */
-	int lgrp[GCTXLEN];	/* lookahead coverage arrays*/
-	int bn, in, ln;		/* size of b[], i[], l[] */
-	int seqidx;		/* sequence index */
+	int *bgrp;		/* backtrack groups, closest first */
+	int *igrp;		/* input groups, followed by lgrp[] */
+	int *lgrp;		/* lookahead groups */
+	int bn, in, ln;		/* size of bgrp[], igrp[], and lgrp[] */
+	int gpos;		/* a positioning context */
 };
 
-static int gctx_len(struct gctx *ctx, int patlen)
+static void gctx_init(struct gctx *ctx, int bn, int in, int ln, int gpos)
+{
+	ctx->bgrp = malloc((bn + in + ln + 1) * sizeof(ctx->bgrp[0]));
+	ctx->igrp = ctx->bgrp + bn;
+	ctx->lgrp = ctx->igrp + in;
+	ctx->bn = bn;
+	ctx->in = in;
+	ctx->ln = ln;
+	ctx->gpos = gpos;
+}
+
+static void gctx_done(struct gctx *ctx)
+{
+	free(ctx->bgrp);
+}
+
+/* the entry at position p of the context in text order */
+static int gctx_at(struct gctx *ctx, int p)
+{
+	return p < ctx->bn ? ctx->bgrp[ctx->bn - 1 - p] : ctx->igrp[p - ctx->bn];
+}
+
+/* check if the context cannot match: it has ignored glyphs or empty groups */
+static int gctx_dead(struct gctx *ctx)
+{
+	int i, e;
+	for (i = 0; i < ctx->bn + ctx->in + ctx->ln; i++) {
+		e = gctx_at(ctx, i);
+		if (e & GCTXGLYPH ? gdef_skip(e & ~GCTXGLYPH) : !ggrp_size(e))
+			return 1;
+	}
+	return 0;
+}
+
+/* print a context entry; gsub context entries are marked with = */
+static void gctx_print(struct gctx *ctx, int grp)
 {
-	return ctx ? ctx->bn + ctx->in + ctx->ln - patlen : 0;
+	char *pre = ctx->gpos ? "" : "=";
+	if (grp & GCTXGLYPH)
+		printf(" %s%s", pre, gname(grp & ~GCTXGLYPH));
+	else
+		printf(" %s@%d", pre, grp);
 }
 
+/* backtrack entries are stored in reverse order */
 static void gctx_backtrack(struct gctx *ctx)
 {
 	int i;
-	if (!ctx)
-		return;
-	for (i = 0; i < ctx->bn; i++)
-		printf(" =@%d", ctx->bgrp[i]);
-	for (i = 0; i < ctx->seqidx; i++)
-		printf(" =@%d", ctx->igrp[i]);
+	for (i = ctx->bn - 1; i >= 0; i--)
+		gctx_print(ctx, ctx->bgrp[i]);
 }
 
-static void gctx_lookahead(struct gctx *ctx, int patlen)
+static void gctx_lookahead(struct gctx *ctx)
 {
 	int i;
-	if (!ctx)
-		return;
-	for (i = ctx->seqidx + patlen; i < ctx->in; i++)
-		printf(" =@%d", ctx->igrp[i]);
 	for (i = 0; i < ctx->ln; i++)
-		printf(" =@%d", ctx->lgrp[i]);
+		gctx_print(ctx, ctx->lgrp[i]);
+}
+
+/* print a substitution rule, or add it to gl for nested lookups */
+static void gsub_rule(struct glookup *gl, int *src, int nsrc, int *dst, int ndst)
+{
+	int ent[256];
+	int i;
+	/* rules with glyphs ignored by the lookup never match */
+	for (i = 0; i < nsrc; i++)
+		if (gdef_skip(src[i]))
+			return;
+	if (!gl) {
+		printf("%d", nsrc + ndst);
+		for (i = 0; i < nsrc; i++)
+			printf(" -%s", gname(src[i]));
+		for (i = 0; i < ndst; i++)
+			printf(" +%s", gname(dst[i]));
+		printf("\n");
+		return;
+	}
+	for (i = 0; i < nsrc && i < LEN(ent); i++)
+		ent[i] = src[i] | GCTXGLYPH;
+	glookup_add(gl, ent, i, dst, ndst, 0);
+}
+
+/* return the given lookup of a lookup list, or NULL if it is invalid */
+static void *otf_lookup(void *lookuplist, int idx)
+{
+	void *lookup;
+	if (!otf_in(lookuplist, 0, 2) || idx >= U16(lookuplist, 0) ||
+			!otf_in(lookuplist, 2 + 2 * idx, 2))
+		return NULL;
+	lookup = lookuplist + U16(lookuplist, 2 + 2 * idx);
+	if (!otf_in(lookup, 0, 6) || !otf_in(lookup, 6, 2 * U16(lookup, 4)))
+		return NULL;
+	return lookup;
 }
 
 /* single substitution */
-static void otf_gsubtype1(struct otf *otf, void *sub, char *feat, struct gctx *ctx)
+static void otf_gsubtype1(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
 	int *cov;
-	int fmt = U16(sub, 0);
+	int fmt;
 	int ncov;
-	int i;
+	int i, dst;
+	if (!otf_in(sub, 0, 6))
+		return;
+	fmt = U16(sub, 0);
 	cov = coverage(sub + U16(sub, 2), &ncov);
 	if (fmt == 1) {
 		for (i = 0; i < ncov; i++) {
-			int dst = cov[i] + S16(sub, 4);
+			dst = cov[i] + S16(sub, 4);
 			if (dst >= glyph_n || dst < 0)
 				continue;
-			printf("%d", 2 + gctx_len(ctx, 1));
-			gctx_backtrack(ctx);
-			printf(" -%s", gname(cov[i]));
-			printf(" +%s", gname(dst));
-			gctx_lookahead(ctx, 1);
-			printf("\n");
+			gsub_rule(gl, &cov[i], 1, &dst, 1);
 		}
 	}
-	if (fmt == 2) {
-		int n = U16(sub, 4);
+	if (fmt == 2 && otf_in(sub, 6, 2 * U16(sub, 4))) {
+		int n = MIN(U16(sub, 4), ncov);
 		for (i = 0; i < n; i++) {
-			printf("%d", 2 + gctx_len(ctx, 1));
-			gctx_backtrack(ctx);
-			printf(" -%s", gname(cov[i]));
-			printf(" +%s", gname(U16(sub, 6 + 2 * i)));
-			gctx_lookahead(ctx, 1);
-			printf("\n");
+			dst = U16(sub, 6 + 2 * i);
+			gsub_rule(gl, &cov[i], 1, &dst, 1);
 		}
 	}
 	free(cov);
 }
 
+/* multiple substitution */
+static void otf_gsubtype2(struct otf *otf, void *sub, char *feat, struct glookup *gl)
+{
+	int *cov;
+	int dst[256];
+	int n, i, j, ncov;
+	if (!otf_in(sub, 0, 6) || U16(sub, 0) != 1)
+		return;
+	if (!otf_in(sub, 6, 2 * U16(sub, 4)))
+		return;
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	n = MIN(U16(sub, 4), ncov);
+	for (i = 0; i < n; i++) {
+		void *seq = sub + U16(sub, 6 + 2 * i);
+		int nseq;
+		if (!otf_in(seq, 0, 2) || !otf_in(seq, 2, 2 * U16(seq, 0)))
+			continue;
+		nseq = U16(seq, 0);
+		/* empty sequences (glyph deletion) are not supported */
+		if (!nseq || nseq > LEN(dst))
+			continue;
+		for (j = 0; j < nseq; j++)
+			dst[j] = U16(seq, 2 + 2 * j);
+		gsub_rule(gl, &cov[i], 1, dst, nseq);
+	}
+	free(cov);
+}
+
 /* alternate substitution */
-static void otf_gsubtype3(struct otf *otf, void *sub, char *feat, struct gctx *ctx)
+static void otf_gsubtype3(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
 	int *cov;
-	int fmt = U16(sub, 0);
-	int n, i, j;
-	if (fmt != 1)
+	int n, i, j, ncov, dst;
+	if (!otf_in(sub, 0, 6) || U16(sub, 0) != 1)
 		return;
-	cov = coverage(sub + U16(sub, 2), NULL);
-	n = U16(sub, 4);
+	if (!otf_in(sub, 6, 2 * U16(sub, 4)))
+		return;
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	n = MIN(U16(sub, 4), ncov);
 	for (i = 0; i < n; i++) {
 		void *alt = sub + U16(sub, 6 + 2 * i);
-		int nalt = U16(alt, 0);
+		int nalt;
+		if (!otf_in(alt, 0, 2) || !otf_in(alt, 2, 2 * U16(alt, 0)))
+			continue;
+		nalt = U16(alt, 0);
 		for (j = 0; j < nalt; j++) {
-			printf("%d", 2 + gctx_len(ctx, 1));
-			gctx_backtrack(ctx);
-			printf(" -%s", gname(cov[i]));
-			printf(" +%s", gname(U16(alt, 2 + 2 * j)));
-			gctx_lookahead(ctx, 1);
-			printf("\n");
+			dst = U16(alt, 2 + 2 * j);
+			gsub_rule(gl, &cov[i], 1, &dst, 1);
 		}
 	}
 	free(cov);
 }
 
 /* ligature substitution */
-static void otf_gsubtype4(struct otf *otf, void *sub, char *feat, struct gctx *ctx)
+static void otf_gsubtype4(struct otf *otf, void *sub, char *feat, struct glookup *gl)
 {
-	int fmt = U16(sub, 0);
 	int *cov;
-	int n, i, j, k;
-	if (fmt != 1)
+	int src[256];
+	int n, i, j, k, ncov, dst;
+	if (!otf_in(sub, 0, 6) || U16(sub, 0) != 1)
+		return;
+	if (!otf_in(sub, 6, 2 * U16(sub, 4)))
 		return;
-	cov = coverage(sub + U16(sub, 2), NULL);
-	n = U16(sub, 4);
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	n = MIN(U16(sub, 4), ncov);
 	for (i = 0; i < n; i++) {
 		void *set = sub + U16(sub, 6 + 2 * i);
-		int nset = U16(set, 0);
+		int nset;
+		if (!otf_in(set, 0, 2) || !otf_in(set, 2, 2 * U16(set, 0)))
+			continue;
+		nset = U16(set, 0);
 		for (j = 0; j < nset; j++) {
 			void *lig = set + U16(set, 2 + 2 * j);
-			int nlig = U16(lig, 2);
-			printf("%d", nlig + 1 + gctx_len(ctx, nlig));
-			gctx_backtrack(ctx);
-			printf(" -%s", gname(cov[i]));
+			int nlig;
+			if (!otf_in(lig, 0, 4) || !U16(lig, 2) ||
+					!otf_in(lig, 4, 2 * (U16(lig, 2) - 1)))
+				continue;
+			nlig = U16(lig, 2);
+			if (nlig > LEN(src))
+				continue;
+			src[0] = cov[i];
 			for (k = 0; k < nlig - 1; k++)
-				printf(" -%s", gname(U16(lig, 4 + 2 * k)));
-			printf(" +%s", gname(U16(lig, 0)));
-			gctx_lookahead(ctx, nlig);
-			printf("\n");
+				src[k + 1] = U16(lig, 4 + 2 * k);
+			dst = U16(lig, 0);
+			gsub_rule(gl, src, nlig, &dst, 1);
 		}
 	}
 	free(cov);
 }
 
-/* chaining contextual substitution */
-static void otf_gsubtype6(struct otf *otf, void *sub, char *feat, void *gsub)
+/* decode a lookup nested in gsub or gpos contexts, once */
+static struct glookup *glookup_get(struct otf *otf, void *gtab, int idx,
+		char *feat, int gpos)
 {
-	struct gctx ctx = {{0}};
-	void *lookups = gsub + U16(gsub, 8);
-	int fmt = U16(sub, 0);
-	int *cov;
-	int i, j, nsub, ncov;
-	int off = 2;
-	if (fmt != 3) {
-		otf_unsupported("GSUB", 6, fmt);
+	void *lookup = otf_lookup(gtab + U16(gtab, 8), idx);
+	struct glookup *gl;
+	void *prev;
+	int ltype, ntabs;
+	int j;
+	if (!lookup || idx >= glookups_n)
+		return NULL;
+	gl = &glookups[gpos && otf_r2l(feat) ? glookups_n + idx : idx];
+	if (gl->done)
+		return gl;
+	gl->done = 1;
+	prev = gdef_lookup(lookup);
+	ltype = U16(lookup, 0);
+	ntabs = U16(lookup, 4);
+	for (j = 0; j < ntabs; j++) {
+		void *tab = lookup + U16(lookup, 6 + 2 * j);
+		int type = ltype;
+		if (type == (gpos ? 9 : 7)) {	/* extension lookups */
+			if (!otf_in(tab, 0, 8))
+				continue;
+			type = U16(tab, 2);
+			tab = tab + U32(tab, 4);
+		}
+		if (!gpos && type == 1)
+			otf_gsubtype1(otf, tab, feat, gl);
+		if (!gpos && type == 2)
+			otf_gsubtype2(otf, tab, feat, gl);
+		if (!gpos && type == 3)
+			otf_gsubtype3(otf, tab, feat, gl);
+		if (!gpos && type == 4)
+			otf_gsubtype4(otf, tab, feat, gl);
+		if (gpos && type == 1)
+			otf_gpostype1(otf, tab, feat, gl);
+		if (gpos && type == 2)
+			otf_gpostype2(otf, tab, feat, gl);
+		if (gpos && (type == 4 || type == 6))
+			otf_gpostype4(otf, tab, feat, gl);
+	}
+	gdef_lookup(prev);
+	return gl;
+}
+
+/* a lookup record of a context rule */
+struct grec {
+	int seq;		/* sequence index */
+	struct glookup *gl;	/* the nested lookup */
+	int *cand;		/* the offsets of the rules matching the context */
+	int ncand;		/* number of entries in cand[] */
+};
+
+/* the entry matching both e and c, or -1 */
+static int gctx_meet(int e, int c)
+{
+	if (e & GCTXGLYPH && c & GCTXGLYPH)
+		return e == c ? e : -1;
+	if (e & GCTXGLYPH)
+		return ggrp_has(c, e & ~GCTXGLYPH) ? e : -1;
+	if (c & GCTXGLYPH)
+		return ggrp_has(e, c & ~GCTXGLYPH) ? c : -1;
+	return ggrp_meet(e, c);
+}
+
+/* the position of nested rule r of a record at sequence index seq */
+static int gctx_pos(struct gctx *ctx, int seq, int *r)
+{
+	return ctx->bn + seq + r[2];
+}
+
+/* check if nested rule r matches the context at sequence index seq */
+static int gctx_match(struct gctx *ctx, int seq, int *r)
+{
+	int p = gctx_pos(ctx, seq, r);
+	int i;
+	/* substitutions change input glyphs only */
+	if (p < (ctx->gpos ? 0 : ctx->bn))
+		return 0;
+	if (p + r[0] > ctx->bn + ctx->in + (ctx->gpos ? ctx->ln : 0))
+		return 0;
+	for (i = 0; i < r[0]; i++)
+		if (gctx_meet(r[3 + i], gctx_at(ctx, p + i)) < 0)
+			return 0;
+	return 1;
+}
+
+/* print the entries of nested rule r at position p */
+static void gctx_nested(struct gctx *ctx, int *r, int p)
+{
+	int *adj;
+	int e, i;
+	for (i = 0; i < r[0] && !ctx->gpos; i++)
+		printf(" -%s", gname(r[3 + i] & ~GCTXGLYPH));
+	for (i = 0; i < r[1] && !ctx->gpos; i++)
+		printf(" +%s", gname(r[3 + r[0] + i]));
+	for (i = 0; i < r[0] && ctx->gpos; i++) {
+		e = gctx_meet(r[3 + i], gctx_at(ctx, p + i));
+		adj = r + 3 + r[0] + 4 * i;
+		if (e & GCTXGLYPH)
+			printf(" %s", gname(e & ~GCTXGLYPH));
+		else
+			printf(" @%d", e);
+		if (adj[0] || adj[1] || adj[2] || adj[3])
+			printf(":%+d%+d%+d%+d", adj[0], adj[1], adj[2], adj[3]);
+	}
+}
+
+/* print a context rule with the selected nested rules (offsets or -1) */
+static void gctx_rule(struct gctx *ctx, struct grec *recs, int nrecs, int *sel)
+{
+	int len = ctx->bn + ctx->in + ctx->ln;
+	int n = len;
+	int *r;
+	int p, k;
+	for (k = 0; k < nrecs && !ctx->gpos; k++)
+		if (sel[k] >= 0)
+			n += recs[k].gl->rules[sel[k] + 1];
+	printf("%d", n);
+	for (p = 0, k = 0; p < len;) {
+		while (k < nrecs && sel[k] < 0)
+			k++;
+		r = k < nrecs ? recs[k].gl->rules + sel[k] : NULL;
+		if (r && gctx_pos(ctx, recs[k].seq, r) == p) {
+			gctx_nested(ctx, r, p);
+			p += r[0];
+			k++;
+		} else {
+			gctx_print(ctx, gctx_at(ctx, p++));
+		}
+	}
+	printf("\n");
+}
+
+/*
+ * Apply the lookup records of a context rule.  A rule is printed for
+ * every combination of the nested rules matching the context,
+ * including leaving some records out; more specific ones come first.
+ * Records are applied in sequence order and may not overlap.
+ */
+static void gctx_lookups(struct otf *otf, struct gctx *ctx, void *recs, int nrecs,
+		char *feat, void *gtab)
+{
+	struct grec *gr = malloc((nrecs + 1) * sizeof(gr[0]));
+	struct grec t;
+	int *idx, *sel, *end;
+	int n = 0, cnt = 0;
+	int i, j, k;
+	if (gctx_dead(ctx)) {
+		free(gr);
 		return;
 	}
-	ctx.bn = U16(sub, off);
-	for (i = 0; i < ctx.bn; i++) {
-		cov = coverage(sub + U16(sub, off + 2 + 2 * i), &ncov);
-		ctx.bgrp[i] = ggrp_coverage(cov, ncov);
-		free(cov);
+	for (i = 0; i < nrecs; i++) {
+		struct glookup *gl = glookup_get(otf, gtab, U16(recs, 4 * i + 2),
+				feat, ctx->gpos);
+		int seq = U16(recs, 4 * i);
+		int *r;
+		if (!gl || seq >= ctx->in)
+			continue;
+		gr[n].seq = seq;
+		gr[n].gl = gl;
+		gr[n].cand = malloc((gl->n / 4 + 1) * sizeof(gr[n].cand[0]));
+		gr[n].ncand = 0;
+		for (j = 0; j < gl->n; j += 3 + r[0] + r[1]) {
+			r = gl->rules + j;
+			if (gctx_match(ctx, seq, r))
+				gr[n].cand[gr[n].ncand++] = j;
+		}
+		if (gr[n].ncand)
+			n++;
+		else
+			free(gr[n].cand);
 	}
-	off += 2 + 2 * ctx.bn;
-	ctx.in = U16(sub, off);
-	for (i = 0; i < ctx.in; i++) {
-		cov = coverage(sub + U16(sub, off + 2 + 2 * i), &ncov);
-		ctx.igrp[i] = ggrp_coverage(cov, ncov);
-		free(cov);
+	/* sort the records by their sequence index */
+	for (i = 1; i < n; i++) {
+		t = gr[i];
+		for (j = i; j > 0 && gr[j - 1].seq > t.seq; j--)
+			gr[j] = gr[j - 1];
+		gr[j] = t;
 	}
-	off += 2 + 2 * ctx.in;
-	ctx.ln = U16(sub, off);
-	for (i = 0; i < ctx.ln; i ++) {
-		cov = coverage(sub + U16(sub, off + 2 + 2 * i), &ncov);
-		ctx.lgrp[i] = ggrp_coverage(cov, ncov);
-		free(cov);
+	idx = malloc((n + 1) * sizeof(idx[0]));
+	sel = malloc((n + 1) * sizeof(sel[0]));
+	end = malloc((n + 1) * sizeof(end[0]));
+	/* enumerate the choices of records; idx[k] == ncand leaves it out */
+	k = 0;
+	idx[0] = -1;
+	end[0] = 0;
+	while (n && k >= 0 && cnt < GCTXRULES) {
+		if (k == n) {
+			for (i = 0; i < n && sel[i] < 0; i++)
+				;
+			if (i < n) {
+				gctx_rule(ctx, gr, n, sel);
+				cnt++;
+			}
+			k--;
+			continue;
+		}
+		if (++idx[k] > gr[k].ncand) {
+			k--;
+			continue;
+		}
+		if (idx[k] < gr[k].ncand) {
+			int *r = gr[k].gl->rules + gr[k].cand[idx[k]];
+			int p = gctx_pos(ctx, gr[k].seq, r);
+			if (p < end[k]) {
+				idx[k] = gr[k].ncand - 1;
+				continue;
+			}
+			sel[k] = gr[k].cand[idx[k]];
+			end[k + 1] = p + r[0];
+		} else {
+			sel[k] = -1;
+			end[k + 1] = end[k];
+		}
+		idx[++k] = -1;
 	}
-	off += 2 + 2 * ctx.ln;
-	nsub = U16(sub, off);	/* nsub > 1 is not supported */
-	for (i = 0; i < nsub && i < 1; i++) {
-		int lidx = U16(sub, off + 2 + 4 * i + 2);
-		void *lookup = lookups + U16(lookups, 2 + 2 * lidx);
-		int ltype = U16(lookup, 0);
-		int ntabs = U16(lookup, 4);
-		ctx.seqidx = U16(sub, off + 2 + 4 * i);
-		for (j = 0; j < ntabs; j++) {
-			void *tab = lookup + U16(lookup, 6 + 2 * j);
-			int type = ltype;
-			if (type == 7) {	/* extension substitution */
-				type = U16(tab, 2);
-				tab = tab + U32(tab, 4);
+	for (i = 0; i < n; i++)
+		free(gr[i].cand);
+	free(idx);
+	free(sel);
+	free(end);
+	free(gr);
+}
+
+/* read the glyphs (fmt 1) or classes (fmt 2) of a context rule into grp */
+static int gctx_class(int fmt, struct gcls *gc, void *rule, int n, int *grp)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		int v = U16(rule, 2 * i);
+		grp[i] = fmt == 1 ? (v | GCTXGLYPH) : gcls_grp(gc, v);
+		if (grp[i] < 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* contextual (chain = 0) and chaining contextual formats 1 and 2 */
+static void otf_ctxrules(struct otf *otf, void *sub, char *feat, void *gtab,
+		int chain, int gpos)
+{
+	struct gctx ctx;
+	struct gcls gc[3];	/* backtrack, input, and lookahead classes */
+	int fmt = U16(sub, 0);
+	int setoff = fmt == 1 ? 4 : (chain ? 10 : 6);
+	int *cov, *g;
+	int nsets, ncov, n;
+	int i, j, k;
+	if (!otf_in(sub, 0, setoff + 2) || !otf_in(sub, setoff + 2, 2 * U16(sub, setoff)))
+		return;
+	nsets = U16(sub, setoff);
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	memset(gc, 0, sizeof(gc));
+	if (fmt == 2)
+		gcls_init(&gc[1], sub + U16(sub, chain ? 6 : 4));
+	if (fmt == 2 && chain) {
+		gcls_init(&gc[0], sub + U16(sub, 4));
+		gcls_init(&gc[2], sub + U16(sub, 8));
+	}
+	g = malloc((ncov + 1) * sizeof(g[0]));
+	for (i = 0; i < nsets; i++) {
+		void *set = sub + U16(sub, setoff + 2 + 2 * i);
+		int first;	/* the first input glyph or group */
+		if (!U16(sub, setoff + 2 + 2 * i))
+			continue;
+		if (!otf_in(set, 0, 2) || !otf_in(set, 2, 2 * U16(set, 0)))
+			continue;
+		if (fmt == 1) {
+			if (i >= ncov)
+				break;
+			first = cov[i] | GCTXGLYPH;
+		} else {
+			/* the covered glyphs of class i */
+			for (n = 0, k = 0; k < ncov; k++)
+				if (classdef_get(sub + U16(sub, chain ? 6 : 4), cov[k]) == i)
+					g[n++] = cov[k];
+			if (!n)
+				continue;
+			first = ggrp_coverage(g, n);
+		}
+		for (j = 0; j < U16(set, 0); j++) {
+			void *rule = set + U16(set, 2 + 2 * j);
+			void *recs;
+			int bn = 0, in, ln = 0;
+			int off = 0, nrecs, bad;
+			if (chain) {
+				if (!otf_in(rule, 0, 2))
+					continue;
+				bn = U16(rule, 0);
+				off = 2 + 2 * bn;
+				if (!otf_in(rule, off, 2) || !U16(rule, off))
+					continue;
+				in = U16(rule, off);
+				off += 2 + 2 * (in - 1);
+				if (!otf_in(rule, off, 2))
+					continue;
+				ln = U16(rule, off);
+				off += 2 + 2 * ln;
+				if (!otf_in(rule, off, 2))
+					continue;
+				nrecs = U16(rule, off);
+				recs = rule + off + 2;
+			} else {
+				if (!otf_in(rule, 0, 4) || !U16(rule, 0))
+					continue;
+				in = U16(rule, 0);
+				nrecs = U16(rule, 2);
+				recs = rule + 4 + 2 * (in - 1);
 			}
-			if (type == 1)
-				otf_gsubtype1(otf, tab, feat, &ctx);
-			if (type == 3)
-				otf_gsubtype3(otf, tab, feat, &ctx);
-			if (type == 4)
-				otf_gsubtype4(otf, tab, feat, &ctx);
+			if (!otf_in(recs, 0, 4 * nrecs))
+				continue;
+			gctx_init(&ctx, bn, in, ln, gpos);
+			if (chain)
+				bad = gctx_class(fmt, &gc[0], rule + 2, bn, ctx.bgrp) ||
+					gctx_class(fmt, &gc[1], rule + 2 + 2 * bn + 2,
+						in - 1, ctx.igrp + 1) ||
+					gctx_class(fmt, &gc[2], recs - 2 * ln - 2,
+						ln, ctx.lgrp);
+			else
+				bad = gctx_class(fmt, &gc[1], rule + 4, in - 1, ctx.igrp + 1);
+			ctx.igrp[0] = first;
+			if (!bad)
+				gctx_lookups(otf, &ctx, recs, nrecs, feat, gtab);
+			gctx_done(&ctx);
 		}
 	}
+	for (i = 0; i < 3; i++)
+		gcls_done(&gc[i]);
+	free(g);
+	free(cov);
+}
+
+/* read n coverage tables, whose offsets are at off, into glyph groups */
+static void gctx_coverage(void *sub, int off, int n, int *grp)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		grp[i] = ggrp_covtab(sub + U16(sub, off + 2 * i));
+}
+
+/* contextual substitution (gsub type 5) and positioning (gpos type 7) */
+static void otf_context(struct otf *otf, void *sub, char *feat, void *gtab, int gpos)
+{
+	struct gctx ctx;
+	int in;
+	if (!otf_in(sub, 0, 6))
+		return;
+	if (U16(sub, 0) == 1 || U16(sub, 0) == 2) {
+		otf_ctxrules(otf, sub, feat, gtab, 0, gpos);
+		return;
+	}
+	if (U16(sub, 0) != 3) {
+		otf_unsupported(gpos ? "GPOS" : "GSUB", gpos ? 7 : 5, U16(sub, 0));
+		return;
+	}
+	in = U16(sub, 2);
+	if (!otf_in(sub, 6, 2 * in + 4 * U16(sub, 4)))
+		return;
+	gctx_init(&ctx, 0, in, 0, gpos);
+	gctx_coverage(sub, 6, in, ctx.igrp);
+	gctx_lookups(otf, &ctx, sub + 6 + 2 * in, U16(sub, 4), feat, gtab);
+	gctx_done(&ctx);
+}
+
+/* chaining contextual substitution (gsub type 6) and positioning (gpos type 8) */
+static void otf_chaincontext(struct otf *otf, void *sub, char *feat, void *gtab, int gpos)
+{
+	struct gctx ctx;
+	int bn, in, ln;
+	int boff, ioff, loff, off;
+	int fmt, nsub;
+	if (!otf_in(sub, 0, 4))
+		return;
+	fmt = U16(sub, 0);
+	if (fmt == 1 || fmt == 2) {
+		otf_ctxrules(otf, sub, feat, gtab, 1, gpos);
+		return;
+	}
+	if (fmt != 3) {
+		otf_unsupported(gpos ? "GPOS" : "GSUB", gpos ? 8 : 6, fmt);
+		return;
+	}
+	boff = 2;
+	bn = U16(sub, boff);
+	ioff = boff + 2 + 2 * bn;
+	if (!otf_in(sub, ioff, 2))
+		return;
+	in = U16(sub, ioff);
+	loff = ioff + 2 + 2 * in;
+	if (!otf_in(sub, loff, 2))
+		return;
+	ln = U16(sub, loff);
+	off = loff + 2 + 2 * ln;
+	if (!otf_in(sub, off, 2))
+		return;
+	nsub = U16(sub, off);
+	if (!otf_in(sub, off + 2, 4 * nsub))
+		return;
+	gctx_init(&ctx, bn, in, ln, gpos);
+	gctx_coverage(sub, boff + 2, bn, ctx.bgrp);
+	gctx_coverage(sub, ioff + 2, in, ctx.igrp);
+	gctx_coverage(sub, loff + 2, ln, ctx.lgrp);
+	gctx_lookups(otf, &ctx, sub + off + 2, nsub, feat, gtab);
+	gctx_done(&ctx);
+}
+
+/* reverse chaining contextual single substitution */
+static void otf_gsubtype8(struct otf *otf, void *sub, char *feat)
+{
+	struct gctx ctx;
+	int *cov;
+	int bn, ln, n, ncov;
+	int boff, loff, off;
+	int i;
+	if (!otf_in(sub, 0, 6))
+		return;
+	if (U16(sub, 0) != 1) {
+		otf_unsupported("GSUB", 8, U16(sub, 0));
+		return;
+	}
+	boff = 4;
+	bn = U16(sub, boff);
+	loff = boff + 2 + 2 * bn;
+	if (!otf_in(sub, loff, 2))
+		return;
+	ln = U16(sub, loff);
+	off = loff + 2 + 2 * ln;
+	if (!otf_in(sub, off, 2) || !otf_in(sub, off + 2, 2 * U16(sub, off)))
+		return;
+	gctx_init(&ctx, bn, 0, ln, 0);
+	gctx_coverage(sub, boff + 2, bn, ctx.bgrp);
+	gctx_coverage(sub, loff + 2, ln, ctx.lgrp);
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	n = gctx_dead(&ctx) ? 0 : MIN(U16(sub, off), ncov);
+	for (i = 0; i < n; i++) {
+		if (gdef_skip(cov[i]))
+			continue;
+		printf("%d", bn + ln + 2);
+		gctx_backtrack(&ctx);
+		printf(" -%s", gname(cov[i]));
+		printf(" +%s", gname(U16(sub, off + 2 + 2 * i)));
+		gctx_lookahead(&ctx);
+		printf("\n");
+	}
+	free(cov);
+	gctx_done(&ctx);
 }
 
 /* an otf gsub/gpos lookup */
@@ -845,53 +2972,146 @@ struct otflookup {
 	char lang[8];		/* language name */
 	char feat[8];		/* feature name */
 	int lookup;		/* index into the lookup table */
+	unsigned long long key;	/* sort key: script, feature rank, lookup */
+};
+
+/* pack the script tag, feature rank, and lookup index into a sort key */
+static unsigned long long lookupkey(char *scrp, int rank, int lookup)
+{
+	unsigned long long key = 0;
+	int i;
+	for (i = 0; i < 4; i++)
+		key = (key << 8) | (unsigned char) (scrp[0] ? scrp[i] : 0);
+	key = (key << 16) | (rank & 0xffff);
+	return (key << 16) | (lookup & 0xffff);
+}
+
+/* a growable collection of lookups, hashed on script, feature, and lookup */
+struct lookups {
+	struct otflookup *lu;	/* collected lookups */
+	int n;			/* number of lookups in lu[] */
+	int sz;			/* size of lu[], next[], and head[] */
+	int *next;		/* the next lookup in the same hash bucket */
+	int *head;		/* the first lookup in each hash bucket */
 };
 
+static int lookups_hash(struct lookups *lus, char *scrp, char *feat, int lookup)
+{
+	unsigned h = lookup;
+	while (*scrp)
+		h = h * 31 + (unsigned char) *scrp++;
+	while (*feat)
+		h = h * 31 + (unsigned char) *feat++;
+	return h & (lus->sz - 1);
+}
+
+static void lookups_extend(struct lookups *lus)
+{
+	int i;
+	lus->sz = lus->sz ? lus->sz * 2 : 256;
+	lus->lu = realloc(lus->lu, lus->sz * sizeof(lus->lu[0]));
+	free(lus->next);
+	free(lus->head);
+	lus->next = malloc(lus->sz * sizeof(lus->next[0]));
+	lus->head = malloc(lus->sz * sizeof(lus->head[0]));
+	for (i = 0; i < lus->sz; i++)
+		lus->head[i] = -1;
+	/* only lookups common to all languages are searched */
+	for (i = 0; i < lus->n; i++) {
+		struct otflookup *lu = &lus->lu[i];
+		if (!lu->lang[0]) {
+			int h = lookups_hash(lus, lu->scrp, lu->feat, lu->lookup);
+			lus->next[i] = lus->head[h];
+			lus->head[h] = i;
+		}
+	}
+}
+
+static void lookups_done(struct lookups *lus)
+{
+	free(lus->next);
+	free(lus->head);
+}
+
+/* find a lookup common to all languages of a script */
+static int lookups_find(struct lookups *lus, char *scrp, char *feat, int lookup)
+{
+	int i = lus->sz ? lus->head[lookups_hash(lus, scrp, feat, lookup)] : -1;
+	while (i >= 0) {
+		struct otflookup *lu = &lus->lu[i];
+		if (lu->lookup == lookup && !strcmp(lu->scrp, scrp) &&
+				!strcmp(lu->feat, feat))
+			return i;
+		i = lus->next[i];
+	}
+	return -1;
+}
+
+static void lookups_add(struct lookups *lus, char *scrp, char *lang,
+		char *feat, int lookup, int rank)
+{
+	struct otflookup *lu;
+	if (lus->n == lus->sz)
+		lookups_extend(lus);
+	lu = &lus->lu[lus->n];
+	strcpy(lu->feat, feat);
+	strcpy(lu->scrp, scrp);
+	strcpy(lu->lang, lang);
+	lu->lookup = lookup;
+	lu->key = lookupkey(scrp, rank, lookup);
+	if (!lang[0]) {
+		int h = lookups_hash(lus, scrp, feat, lookup);
+		lus->next[lus->n] = lus->head[h];
+		lus->head[h] = lus->n;
+	}
+	lus->n++;
+}
+
 /* parse the given gsub/gpos feature table */
-static int otf_featrec(struct otf *otf, void *gtab, void *featrec,
-			char *stag, char *ltag,
-			struct otflookup *lookups, int lookups_n)
+static void otf_featrec(struct otf *otf, void *gtab, void *featrec,
+			char *stag, char *ltag, struct lookups *lus)
 {
 	void *feats = gtab + U16(gtab, 6);
 	void *feat = feats + U16(featrec, 4);
 	char ftag[8] = "";
-	int n = U16(feat, 2);
-	int i, j;
+	void *lookuplist = gtab + U16(gtab, 8);
+	int n;
+	int rank;
+	int i;
+	if (!otf_in(feat, 0, 4) || !otf_in(feat, 4, 2 * U16(feat, 2)))
+		return;
+	if (!otf_in(lookuplist, 0, 2))
+		return;
+	n = U16(feat, 2);
 	memcpy(ftag, featrec, 4);
+	rank = mkfn_featrank(stag, ftag);
 	for (i = 0; i < n; i++) {
 		int lookup = U16(feat, 4 + 2 * i);	/* lookup index */
+		if (lookup >= U16(lookuplist, 0))
+			continue;
 		/* do not store features common to all languages in a script */
-		for (j = 0; j < lookups_n; j++)
-			if (lookups[j].lookup == lookup && !lookups[j].lang[0])
-				if (!strcmp(lookups[j].scrp, stag) &&
-						!strcmp(lookups[j].feat, ftag))
-					break;
-		if (j == lookups_n) {
-			strcpy(lookups[j].feat, ftag);
-			strcpy(lookups[j].scrp, stag);
-			strcpy(lookups[j].lang, ltag);
-			lookups[j].lookup = U16(feat, 4 + 2 * i);
-			lookups_n++;
-		}
+		if (lookups_find(lus, stag, ftag, lookup) < 0)
+			lookups_add(lus, stag, ltag, ftag, lookup, rank);
 	}
-	return lookups_n;
 }
 
 /* parse the given language table and its feature tables */
-static int otf_lang(struct otf *otf, void *gtab, void *lang, char *stag, char *ltag,
-		struct otflookup *lookups, int lookups_n)
+static void otf_lang(struct otf *otf, void *gtab, void *lang, char *stag, char *ltag,
+		struct lookups *lus)
 {
-	void *feats = gtab + U16(gtab, 6);
-	int featidx = U16(lang, 2);
-	int nfeat = U16(lang, 4);
+	void *feats = gtab + U16(gtab, 6);	/* checked in otf_gtab() */
+	int featidx, nfeat;
 	int i;
-	if (featidx != 0xffff)
-		lookups_n = otf_featrec(otf, gtab, feats + 2 + 6 * featidx,
-				stag, ltag, lookups, lookups_n);
+	if (!otf_in(lang, 0, 6) || !otf_in(lang, 6, 2 * U16(lang, 4)))
+		return;
+	featidx = U16(lang, 2);
+	nfeat = U16(lang, 4);
+	if (featidx != 0xffff && featidx < U16(feats, 0))
+		otf_featrec(otf, gtab, feats + 2 + 6 * featidx, stag, ltag, lus);
 	for (i = 0; i < nfeat; i++)
-		lookups_n = otf_featrec(otf, gtab, feats + 2 + 6 * U16(lang, 6 + 2 * i),
-				stag, ltag, lookups, lookups_n);
-	return lookups_n;
+		if (U16(lang, 6 + 2 * i) < U16(feats, 0))
+			otf_featrec(otf, gtab, feats + 2 + 6 * U16(lang, 6 + 2 * i),
+					stag, ltag, lus);
 }
 
 /* return lookup table tag (i.e. liga:latn:ENG); returns a static buffer */
@@ -908,22 +3128,24 @@ static int lookupcmp(void *v1, void *v2)
 {
 	struct otflookup *l1 = v1;
 	struct otflookup *l2 = v2;
-	if (strcmp(l1->scrp, l2->scrp))
-		return strcmp(l1->scrp, l2->scrp);
-	if (mkfn_featrank(l1->scrp, l1->feat) != mkfn_featrank(l1->scrp, l2->feat))
-		return mkfn_featrank(l1->scrp, l1->feat) - mkfn_featrank(l1->scrp, l2->feat);
-	return l1->lookup - l2->lookup;
+	return l1->key < l2->key ? -1 : l1->key > l2->key;
 }
 
 /* extract lookup tables for all features of the given gsub/gpos table */
-static int otf_gtab(struct otf *otf, void *gpos, struct otflookup *lookups)
+static struct otflookup *otf_gtab(struct otf *otf, void *gpos, int *n)
 {
+	struct lookups lus = {NULL};
 	void *scripts = gpos + U16(gpos, 4);
+	void *feats = gpos + U16(gpos, 6);
 	int nscripts, nlangs;
 	void *script;
 	char stag[8], ltag[8];		/* script and language tags */
 	int i, j;
-	int n = 0;
+	*n = 0;
+	if (!otf_in(scripts, 0, 2) || !otf_in(scripts, 2, 6 * U16(scripts, 0)))
+		return NULL;
+	if (!otf_in(feats, 0, 2) || !otf_in(feats, 2, 6 * U16(feats, 0)))
+		return NULL;
 	nscripts = U16(scripts, 0);
 	for (i = 0; i < nscripts; i++) {
 		void *grec = scripts + 2 + 6 * i;
@@ -932,87 +3154,121 @@ static int otf_gtab(struct otf *otf, void *gpos, struct otflookup *lookups)
 		if (!mkfn_script(stag, nscripts))
 			continue;
 		script = scripts + U16(grec, 4);
+		if (!otf_in(script, 0, 4) || !otf_in(script, 4, 6 * U16(script, 2)))
+			continue;
 		nlangs = U16(script, 2);
-		if (U16(script, 0) && mkfn_lang(NULL, nlangs + (U16(script, 0) != 0)))
-			n = otf_lang(otf, gpos, script + U16(script, 0),
-						stag, "", lookups, n);
+		if (U16(script, 0) && mkfn_lang(NULL, nlangs + (U16(script, 0) != 0)) &&
+				!mkfn_dry)
+			otf_lang(otf, gpos, script + U16(script, 0),
+						stag, "", &lus);
 		for (j = 0; j < nlangs; j++) {
 			void *lrec = script + 4 + 6 * j;
 			memcpy(ltag, lrec, 4);
 			ltag[4] = '\0';
-			if (mkfn_lang(ltag, nlangs + (U16(script, 0) != 0)))
-				n = otf_lang(otf, gpos, script + U16(lrec, 4),
-						stag, ltag, lookups, n);
+			if (mkfn_lang(ltag, nlangs + (U16(script, 0) != 0)) && !mkfn_dry)
+				otf_lang(otf, gpos, script + U16(lrec, 4),
+						stag, ltag, &lus);
 		}
 	}
-	qsort(lookups, n, sizeof(lookups[0]), (void *) lookupcmp);
-	return n;
+	lookups_done(&lus);
+	if (lus.n)
+		qsort(lus.lu, lus.n, sizeof(lus.lu[0]), (void *) lookupcmp);
+	*n = lus.n;
+	return lus.lu;
 }
 
-static void otf_gpos(struct otf *otf, void *gpos)
+static void otf_gpos(struct otf *otf, void *gpos,
+		struct otflookup *lookups, int nlookups)
 {
-	struct otflookup lookups[NLOOKUPS];
 	void *lookuplist = gpos + U16(gpos, 8);
-	int nlookups = otf_gtab(otf, gpos, lookups);
 	int i, j;
-	if (mkfn_dry)
+	if (mkfn_dry) {
+		free(lookups);
 		return;
+	}
+	glookups_init(lookuplist);
 	for (i = 0; i < nlookups; i++) {
-		void *lookup = lookuplist + U16(lookuplist, 2 + 2 * lookups[i].lookup);
-		int ltype = U16(lookup, 0);
-		int ntabs = U16(lookup, 4);
+		void *lookup = otf_lookup(lookuplist, lookups[i].lookup);
+		int ltype, ntabs;
 		char *tag = lookuptag(&lookups[i]);
+		if (!lookup)
+			continue;
+		ltype = U16(lookup, 0);
+		ntabs = U16(lookup, 4);
 		sec = (i + 1) * 10;
+		gdef_lookup(lookup);
 		printf("gsec %d gpos %s\n", sec, tag);
 		for (j = 0; j < ntabs; j++) {
 			void *tab = lookup + U16(lookup, 6 + 2 * j);
 			int type = ltype;
 			if (type == 9) {	/* extension positioning */
+				if (!otf_in(tab, 0, 8))
+					continue;
 				type = U16(tab, 2);
 				tab = tab + U32(tab, 4);
 			}
 			switch (type) {
 			case 1:
-				otf_gpostype1(otf, tab, tag);
+				otf_gpostype1(otf, tab, tag, NULL);
 				break;
 			case 2:
-				otf_gpostype2(otf, tab, tag);
+				otf_gpostype2(otf, tab, tag, NULL);
 				break;
 			case 3:
 				otf_gpostype3(otf, tab, tag);
 				break;
 			case 4:
-				otf_gpostype4(otf, tab, tag);
+				otf_gpostype4(otf, tab, tag, NULL);
 				break;
 			case 5:
 				otf_gpostype5(otf, tab, tag);
 				break;
+			case 6:
+				otf_gpostype4(otf, tab, tag, NULL);
+				break;
+			case 7:
+				otf_context(otf, tab, tag, gpos, 1);
+				break;
+			case 8:
+				otf_chaincontext(otf, tab, tag, gpos, 1);
+				break;
 			default:
 				otf_unsupported("GPOS", type, 0);
 			}
 		}
 	}
+	gdef_lookup(NULL);
+	glookups_done();
+	free(lookups);
 }
 
-static void otf_gsub(struct otf *otf, void *gsub)
+static void otf_gsub(struct otf *otf, void *gsub,
+		struct otflookup *lookups, int nlookups)
 {
-	struct otflookup lookups[NLOOKUPS];
 	void *lookuplist = gsub + U16(gsub, 8);
-	int nlookups = otf_gtab(otf, gsub, lookups);
 	int i, j;
-	if (mkfn_dry)
+	if (mkfn_dry) {
+		free(lookups);
 		return;
+	}
+	glookups_init(lookuplist);
 	for (i = 0; i < nlookups; i++) {
-		void *lookup = lookuplist + U16(lookuplist, 2 + 2 * lookups[i].lookup);
-		int ltype = U16(lookup, 0);
-		int ntabs = U16(lookup, 4);
+		void *lookup = otf_lookup(lookuplist, lookups[i].lookup);
+		int ltype, ntabs;
 		char *tag = lookuptag(&lookups[i]);
+		if (!lookup)
+			continue;
+		ltype = U16(lookup, 0);
+		ntabs = U16(lookup, 4);
 		sec = (i + 1) * 10;
+		gdef_lookup(lookup);
 		printf("gsec %d gsub %s\n", sec, tag);
 		for (j = 0; j < ntabs; j++) {
 			void *tab = lookup + U16(lookup, 6 + 2 * j);
 			int type = ltype;
 			if (type == 7) {	/* extension substitution */
+				if (!otf_in(tab, 0, 8))
+					continue;
 				type = U16(tab, 2);
 				tab = tab + U32(tab, 4);
 			}
@@ -1020,20 +3276,32 @@ static void otf_gsub(struct otf *otf, void *gsub)
 			case 1:
 				otf_gsubtype1(otf, tab, tag, NULL);
 				break;
+			case 2:
+				otf_gsubtype2(otf, tab, tag, NULL);
+				break;
 			case 3:
 				otf_gsubtype3(otf, tab, tag, NULL);
 				break;
 			case 4:
 				otf_gsubtype4(otf, tab, tag, NULL);
 				break;
+			case 5:
+				otf_context(otf, tab, tag, gsub, 0);
+				break;
 			case 6:
-				otf_gsubtype6(otf, tab, tag, gsub);
+				otf_chaincontext(otf, tab, tag, gsub, 0);
+				break;
+			case 8:
+				otf_gsubtype8(otf, tab, tag);
 				break;
 			default:
 				otf_unsupported("GSUB", type, 0);
 			}
 		}
 	}
+	gdef_lookup(NULL);
+	glookups_done();
+	free(lookups);
 }
 
 /* read a cff offset, which has sz bytes */
@@ -1051,6 +3319,10 @@ static int cff_op(void *tab, int off, int *val)
 {
 	int b0 = U8(tab, off);
 	int i;
+	if (!otf_in(tab, off, b0 == 28 ? 3 : (b0 == 29 ? 5 : (b0 >= 247 ? 2 : 1)))) {
+		*val = 0;
+		return 1;
+	}
 	if (b0 >= 32 && b0 <= 246) {
 		*val = b0 - 139;
 		return 1;
@@ -1073,7 +3345,7 @@ static int cff_op(void *tab, int off, int *val)
 		return 5;
 	}
 	if (b0 == 30) {
-		for (i = 1; i < 32; i++) {
+		for (i = 1; i < 32 && otf_in(tab, off + i, 1); i++) {
 			int nib = U8(tab, off + i);
 			if ((nib & 0x0f) == 0x0f || (nib & 0xf0) == 0xf0)
 				break;
@@ -1085,25 +3357,56 @@ static int cff_op(void *tab, int off, int *val)
 	return 1;
 }
 
+static int cff2;			/* reading a CFF2 table */
+
+/* the number of items of a cff index; its count is 32-bit in CFF2 */
 static int cffidx_cnt(void *idx)
 {
-	return U16(idx, 0);
+	return cff2 ? U32(idx, 0) : U16(idx, 0);
+}
+
+static int cffidx_hdr(void)
+{
+	return cff2 ? 4 : 2;
+}
+
+/* check the offset array of a cff index and its last offset */
+static int cffidx_ok(void *idx)
+{
+	int hdr = cffidx_hdr();
+	int cnt, sz;
+	if (!otf_in(idx, 0, hdr))
+		return 0;
+	cnt = cffidx_cnt(idx);
+	if (!cnt)
+		return 1;
+	if (cnt < 0 || cnt > NGLYPHS * 4)
+		return 0;
+	if (!otf_in(idx, hdr, 1) || (sz = U8(idx, hdr)) < 1 || sz > 4)
+		return 0;
+	if (!otf_in(idx, hdr + 1, (cnt + 1) * sz))
+		return 0;
+	return otf_in(idx, hdr + (cnt + 1) * sz, cff_int(idx, hdr + 1 + cnt * sz, sz));
 }
 
 static void *cffidx_get(void *idx, int i)
 {
-	int cnt = U16(idx, 0);
-	int sz = U8(idx, 2);
-	return idx + 3 + (cnt + 1) * sz - 1 + cff_int(idx, 3 + i * sz, sz);
+	int hdr = cffidx_hdr();
+	int cnt = cffidx_cnt(idx);
+	int sz = U8(idx, hdr);
+	return idx + hdr + (cnt + 1) * sz + cff_int(idx, hdr + 1 + i * sz, sz);
 }
 
 static int cffidx_len(void *idx, int i)
 {
-	return cffidx_get(idx, i + 1) - cffidx_get(idx, i);
+	int len = cffidx_get(idx, i + 1) - cffidx_get(idx, i);
+	return otf_in(cffidx_get(idx, i), 0, len) ? len : 0;
 }
 
 static void *cffidx_end(void *idx)
 {
+	if (!cffidx_cnt(idx))
+		return idx + cffidx_hdr();
 	return cffidx_get(idx, cffidx_cnt(idx));
 }
 
@@ -1115,17 +3418,18 @@ static int cffdict_get(void *dict, int len, int key, int *args)
 	int val = 0;
 	/* operators: keys (one or two bytes); operands: values */
 	while (off < len) {
+		int isop = U8(dict, off) <= 27;
 		val = op;
 		if (args) {
 			memmove(args + 1, args + 0, 3 * sizeof(args[0]));
 			args[0] = val;
 		}
 		off += cff_op(dict, off, &op);
-		if (op == 12) {			/* two-byte operator */
-			off += cff_op(dict, off, &op);
-			op += 1200;
+		if (isop && op == 12) {		/* two-byte operator */
+			op = off < len ? 1200 + U8(dict, off) : 0;
+			off++;
 		}
-		if (op == key)
+		if (isop && op == key)
 			return val;
 	}
 	return 0;
@@ -1139,6 +3443,10 @@ static void cff_char(void *stridx, int id, char *dst)
 		return;
 	}
 	id -= 391;
+	if (id >= cffidx_cnt(stridx)) {
+		dst[0] = '\0';
+		return;
+	}
 	len = cffidx_len(stridx, id);
 	if (mkfn_warn && len >= GNLEN)
 		fprintf(stderr, "neatmkfn: truncating glyph names (GNLEN is too small)\n");
@@ -1148,6 +3456,392 @@ static void cff_char(void *stridx, int id, char *dst)
 	dst[len] = '\0';
 }
 
+/* cff subroutines */
+struct cffsubrs {
+	void **beg;		/* subroutine charstrings */
+	int *len;		/* subroutine lengths */
+	int n;			/* number of subroutines */
+	int bias;		/* subroutine number bias */
+};
+
+/* decode the offsets of a subroutine index once */
+static void cffsubrs_init(struct cffsubrs *subrs, void *idx)
+{
+	int i;
+	memset(subrs, 0, sizeof(*subrs));
+	if (!idx || !cffidx_ok(idx))
+		return;
+	subrs->n = cffidx_cnt(idx);
+	subrs->bias = subrs->n < 1240 ? 107 : (subrs->n < 33900 ? 1131 : 32768);
+	subrs->beg = malloc(subrs->n * sizeof(subrs->beg[0]));
+	subrs->len = malloc(subrs->n * sizeof(subrs->len[0]));
+	for (i = 0; i < subrs->n; i++) {
+		subrs->beg[i] = cffidx_get(idx, i);
+		subrs->len[i] = cffidx_len(idx, i);
+	}
+}
+
+static void cffsubrs_done(struct cffsubrs *subrs)
+{
+	free(subrs->beg);
+	free(subrs->len);
+}
+
+/* the local subroutines and the default vsindex of a font dict */
+static void cff_private(void *cff, void *dict, int len,
+		struct cffsubrs *subrs, int *vsindex)
+{
+	int args[4] = {0};
+	int off = cffdict_get(dict, len, 18, args);
+	int size = args[1];
+	int lsubrs;
+	*vsindex = 0;
+	if (!off || !otf_in(cff, off, size)) {
+		cffsubrs_init(subrs, NULL);
+		return;
+	}
+	lsubrs = cffdict_get(cff + off, size, 19, NULL);
+	*vsindex = cffdict_get(cff + off, size, 22, NULL);
+	cffsubrs_init(subrs, lsubrs ? cff + off + lsubrs : NULL);
+}
+
+/* the font dict of glyph g in cid-keyed fonts */
+static int cff_fdselect(void *fdsel, int g)
+{
+	int l, h, m;
+	if (!otf_in(fdsel, 0, 1))
+		return 0;
+	if (U8(fdsel, 0) == 0)
+		return otf_in(fdsel, 1 + g, 1) ? U8(fdsel, 1 + g) : 0;
+	if (U8(fdsel, 0) == 4 && otf_in(fdsel, 1, 4)) {	/* cff2 */
+		h = MIN(U32(fdsel, 1), NGLYPHS);
+		if (!otf_in(fdsel, 5, 6 * h + 4))
+			return 0;
+		l = 0;
+		while (l < h) {
+			m = (l + h) / 2;
+			if (g < U32(fdsel, 5 + 6 * m))
+				h = m;
+			else if (g >= U32(fdsel, 5 + 6 * m + 6))
+				l = m + 1;
+			else
+				return U16(fdsel, 5 + 6 * m + 4);
+		}
+		return 0;
+	}
+	if (U8(fdsel, 0) != 3 || !otf_in(fdsel, 1, 2))
+		return 0;
+	h = U16(fdsel, 1);
+	if (!otf_in(fdsel, 3, 3 * h + 2))
+		return 0;
+	l = 0;
+	while (l < h) {
+		m = (l + h) / 2;
+		if (g < U16(fdsel, 3 + 3 * m))
+			h = m;
+		else if (g >= U16(fdsel, 3 + 3 * m + 3))
+			l = m + 1;
+		else
+			return U8(fdsel, 3 + 3 * m + 2);
+	}
+	return 0;
+}
+
+/* type 2 charstring interpreter */
+struct cffcs {
+	struct cffsubrs *gsubrs;	/* global subroutines */
+	struct cffsubrs *lsubrs;	/* local subroutines */
+	struct ivs *vs;			/* CFF2 variation store */
+	int vsindex;			/* CFF2 item variation data */
+	double stk[513];		/* argument stack */
+	int n;				/* number of arguments */
+	int nstems;			/* number of stem hints */
+	int depth;			/* subroutine nesting depth */
+	long nops;			/* number of executed operators */
+	double x, y;			/* current point */
+	struct bbox bb;			/* glyph bounding box */
+};
+
+static void cs_line(struct cffcs *cs, double dx, double dy)
+{
+	cs->x += dx;
+	cs->y += dy;
+	bbox_line(&cs->bb, cs->x, cs->y);
+}
+
+static void cs_curve(struct cffcs *cs, double dx1, double dy1,
+		double dx2, double dy2, double dx3, double dy3)
+{
+	double x1 = cs->x + dx1, y1 = cs->y + dy1;
+	double x2 = x1 + dx2, y2 = y1 + dy2;
+	cs->x = x2 + dx3;
+	cs->y = y2 + dy3;
+	bbox_curve(&cs->bb, x1, y1, x2, y2, cs->x, cs->y);
+}
+
+static void cs_moveto(struct cffcs *cs, double dx, double dy)
+{
+	cs->x += dx;
+	cs->y += dy;
+	bbox_move(&cs->bb, cs->x, cs->y);
+}
+
+/* flex operators (12 34 to 12 37) */
+static void cs_flex(struct cffcs *cs, int op)
+{
+	double *a = cs->stk;
+	double dx, dy;
+	int i;
+	if (op == 34 && cs->n >= 7) {
+		cs_curve(cs, a[0], 0, a[1], a[2], a[3], 0);
+		cs_curve(cs, a[4], 0, a[5], -a[2], a[6], 0);
+	}
+	if (op == 35 && cs->n >= 12) {
+		cs_curve(cs, a[0], a[1], a[2], a[3], a[4], a[5]);
+		cs_curve(cs, a[6], a[7], a[8], a[9], a[10], a[11]);
+	}
+	if (op == 36 && cs->n >= 9) {
+		cs_curve(cs, a[0], a[1], a[2], a[3], a[4], 0);
+		cs_curve(cs, a[5], 0, a[6], a[7], a[8], -(a[1] + a[3] + a[7]));
+	}
+	if (op == 37 && cs->n >= 11) {
+		dx = 0;
+		dy = 0;
+		for (i = 0; i < 10; i += 2) {
+			dx += a[i];
+			dy += a[i + 1];
+		}
+		cs_curve(cs, a[0], a[1], a[2], a[3], a[4], a[5]);
+		if ((dx < 0 ? -dx : dx) > (dy < 0 ? -dy : dy))
+			cs_curve(cs, a[6], a[7], a[8], a[9], a[10], -dy);
+		else
+			cs_curve(cs, a[6], a[7], a[8], a[9], -dx, a[10]);
+	}
+}
+
+/* execute a charstring; return nonzero after endchar or errors */
+static int cs_exec(struct cffcs *cs, void *str, int len)
+{
+	double *a = cs->stk;
+	double scl[LEN(cs->stk)];
+	struct cffsubrs *subrs;
+	int off = 0;
+	int op, i, j, idx, nb, k;
+	while (off < len) {
+		op = U8(str, off);
+		/* operands */
+		if (op == 28 || op >= 32) {
+			int sz = op == 28 ? 3 : (op == 255 ? 5 : (op >= 247 ? 2 : 1));
+			double val = op - 139;
+			if (off + sz > len)
+				return 1;
+			if (op == 28)
+				val = S16(str, off + 1);
+			if (op >= 247 && op <= 250)
+				val = (op - 247) * 256 + U8(str, off + 1) + 108;
+			if (op >= 251 && op <= 254)
+				val = -(op - 251) * 256 - U8(str, off + 1) - 108;
+			if (op == 255)
+				val = S32(str, off + 1) / 65536.0;
+			if (cs->n < LEN(cs->stk))
+				a[cs->n++] = val;
+			off += sz;
+			continue;
+		}
+		off++;
+		if (++cs->nops > (1 << 18))
+			return 1;
+		switch (op) {
+		case 1:		/* hstem */
+		case 3:		/* vstem */
+		case 18:	/* hstemhm */
+		case 23:	/* vstemhm */
+			cs->nstems += cs->n / 2;
+			break;
+		case 19:	/* hintmask */
+		case 20:	/* cntrmask */
+			cs->nstems += cs->n / 2;
+			off += (cs->nstems + 7) / 8;
+			break;
+		case 21:	/* rmoveto */
+			if (cs->n >= 2)
+				cs_moveto(cs, a[cs->n - 2], a[cs->n - 1]);
+			break;
+		case 22:	/* hmoveto */
+			if (cs->n >= 1)
+				cs_moveto(cs, a[cs->n - 1], 0);
+			break;
+		case 4:		/* vmoveto */
+			if (cs->n >= 1)
+				cs_moveto(cs, 0, a[cs->n - 1]);
+			break;
+		case 5:		/* rlineto */
+			for (i = 0; i + 2 <= cs->n; i += 2)
+				cs_line(cs, a[i], a[i + 1]);
+			break;
+		case 6:		/* hlineto */
+		case 7:		/* vlineto */
+			for (i = 0; i < cs->n; i++) {
+				if ((i % 2 == 0) == (op == 6))
+					cs_line(cs, a[i], 0);
+				else
+					cs_line(cs, 0, a[i]);
+			}
+			break;
+		case 8:		/* rrcurveto */
+			for (i = 0; i + 6 <= cs->n; i += 6)
+				cs_curve(cs, a[i], a[i + 1], a[i + 2],
+					a[i + 3], a[i + 4], a[i + 5]);
+			break;
+		case 24:	/* rcurveline */
+			for (i = 0; i + 6 <= cs->n - 2; i += 6)
+				cs_curve(cs, a[i], a[i + 1], a[i + 2],
+					a[i + 3], a[i + 4], a[i + 5]);
+			if (i + 2 <= cs->n)
+				cs_line(cs, a[i], a[i + 1]);
+			break;
+		case 25:	/* rlinecurve */
+			for (i = 0; i + 2 <= cs->n - 6; i += 2)
+				cs_line(cs, a[i], a[i + 1]);
+			if (i + 6 <= cs->n)
+				cs_curve(cs, a[i], a[i + 1], a[i + 2],
+					a[i + 3], a[i + 4], a[i + 5]);
+			break;
+		case 26:	/* vvcurveto */
+			for (i = cs->n % 2; i + 4 <= cs->n; i += 4)
+				cs_curve(cs, i == 1 ? a[0] : 0, a[i],
+					a[i + 1], a[i + 2], 0, a[i + 3]);
+			break;
+		case 27:	/* hhcurveto */
+			for (i = cs->n % 2; i + 4 <= cs->n; i += 4)
+				cs_curve(cs, a[i], i == 1 ? a[0] : 0,
+					a[i + 1], a[i + 2], a[i + 3], 0);
+			break;
+		case 30:	/* vhcurveto */
+		case 31:	/* hvcurveto */
+			for (i = 0; i + 4 <= cs->n; i += 4) {
+				double df = cs->n - i == 5 ? a[i + 4] : 0;
+				if ((i / 4 % 2 == 0) == (op == 31))
+					cs_curve(cs, a[i], 0, a[i + 1],
+						a[i + 2], df, a[i + 3]);
+				else
+					cs_curve(cs, 0, a[i], a[i + 1],
+						a[i + 2], a[i + 3], df);
+			}
+			break;
+		case 10:	/* callsubr */
+		case 29:	/* callgsubr */
+			subrs = op == 10 ? cs->lsubrs : cs->gsubrs;
+			if (!cs->n || cs->depth >= 10)
+				return 1;
+			idx = (int) a[--cs->n] + subrs->bias;
+			if (idx < 0 || idx >= subrs->n)
+				return 1;
+			cs->depth++;
+			if (cs_exec(cs, subrs->beg[idx], subrs->len[idx]))
+				return 1;
+			cs->depth--;
+			continue;
+		case 11:	/* return */
+			return 0;
+		case 15:	/* vsindex (cff2) */
+			if (cs->n && a[cs->n - 1] >= 0 && a[cs->n - 1] < 1 << 16)
+				cs->vsindex = a[cs->n - 1];
+			break;
+		case 16:	/* blend (cff2) */
+			if (!cs->vs)	/* reserved in cff */
+				break;
+			if (!cs->n || a[cs->n - 1] < 0 || a[cs->n - 1] > cs->n)
+				return 1;
+			nb = a[--cs->n];
+			k = ivs_scalars(cs->vs, cs->vsindex, scl, LEN(scl));
+			if (nb < 0 || nb * (k + 1) > cs->n)
+				return 1;
+			idx = cs->n - nb * (k + 1);
+			for (i = 0; i < nb; i++)
+				for (j = 0; j < k; j++)
+					a[idx + i] += a[idx + nb + i * k + j] * scl[j];
+			cs->n = idx + nb;
+			continue;
+		case 14:	/* endchar */
+			return 1;
+		case 12:	/* escape */
+			if (off >= len)
+				return 1;
+			cs_flex(cs, U8(str, off++));
+			break;
+		}
+		cs->n = 0;
+	}
+	return 0;
+}
+
+/* compute glyph bounding boxes from type 2 charstrings */
+static void cff_bbox(void *cff, void *topdict, int toplen, void *chridx,
+		void *gsubridx, struct ivs *vs)
+{
+	struct cffsubrs gsubrs;
+	struct cffsubrs *lsubrs;
+	struct cffcs cs;
+	int *vsindex;
+	void *fdidx = NULL;
+	void *fdsel = NULL;
+	int nfd = 1;
+	int i, fd;
+	if (cffdict_get(topdict, toplen, 1236, NULL)) {
+		fdidx = cff + cffdict_get(topdict, toplen, 1236, NULL);
+		if (cffdict_get(topdict, toplen, 1237, NULL))
+			fdsel = cff + cffdict_get(topdict, toplen, 1237, NULL);
+		if (!cffidx_ok(fdidx) || cffidx_cnt(fdidx) < 1)
+			return;
+		nfd = cffidx_cnt(fdidx);
+	}
+	cffsubrs_init(&gsubrs, gsubridx);
+	lsubrs = malloc(nfd * sizeof(lsubrs[0]));
+	vsindex = malloc(nfd * sizeof(vsindex[0]));
+	for (i = 0; i < nfd; i++) {
+		if (fdidx)
+			cff_private(cff, cffidx_get(fdidx, i),
+				cffidx_len(fdidx, i), &lsubrs[i], &vsindex[i]);
+		else
+			cff_private(cff, topdict, toplen, &lsubrs[i], &vsindex[i]);
+	}
+	for (i = 0; i < glyph_n && i < cffidx_cnt(chridx); i++) {
+		fd = fdsel ? cff_fdselect(fdsel, i) : 0;
+		memset(&cs, 0, sizeof(cs));
+		cs.gsubrs = &gsubrs;
+		cs.lsubrs = &lsubrs[fd < nfd ? fd : 0];
+		cs.vs = vs;
+		cs.vsindex = vsindex[fd < nfd ? fd : 0];
+		cs_exec(&cs, cffidx_get(chridx, i), cffidx_len(chridx, i));
+		if (cs.bb.n)
+			bbox_get(&cs.bb, 1, glyph_bbox[i]);
+	}
+	for (i = 0; i < nfd; i++)
+		cffsubrs_done(&lsubrs[i]);
+	free(lsubrs);
+	free(vsindex);
+	cffsubrs_done(&gsubrs);
+}
+
+/* read font name from cff name index */
+static void otf_cffname(struct otf *otf, void *cff)
+{
+	void *nameidx;		/* name index */
+	char name[256] = "";
+	if (!otf_in(cff, 0, 4) || U8(cff, 0) != 1)
+		return;
+	nameidx = cff + U8(cff, 2);
+	if (!cffidx_ok(nameidx))
+		return;
+	if (cffidx_cnt(nameidx) > 0) {
+		memcpy(name, cffidx_get(nameidx, 0),
+			MIN(cffidx_len(nameidx, 0), sizeof(name) - 1));
+		if (name[0] && !otf->name[0])
+			snprintf(otf->name, sizeof(otf->name), "%s", name);
+	}
+}
+
 static void otf_cff(struct otf *otf, void *cff)
 {
 	void *nameidx;		/* name index */
@@ -1157,37 +3851,39 @@ static void otf_cff(struct otf *otf, void *cff)
 	void *charset;		/* charset offset */
 	int badcff;		/* invalid CFF SIDs */
 	int i, j;
-	if (U8(cff, 0) != 1)
+	if (!otf_in(cff, 0, 4) || U8(cff, 0) != 1)
 		return;
 	nameidx = cff + U8(cff, 2);
+	if (!cffidx_ok(nameidx) || cffidx_cnt(nameidx) < 1)
+		return;
 	topidx = cffidx_end(nameidx);
-	if (cffidx_cnt(nameidx) < 1)
+	if (!cffidx_ok(topidx) || cffidx_cnt(topidx) < 1)
 		return;
 	stridx = cffidx_end(topidx);
+	if (!cffidx_ok(stridx))
+		return;
 	chridx = cff + cffdict_get(cffidx_get(topidx, 0),
 			cffidx_len(topidx, 0), 17, NULL);
 	charset = cff + cffdict_get(cffidx_get(topidx, 0),
 			cffidx_len(topidx, 0), 15, NULL);
+	if (!cffidx_ok(chridx) || !otf_in(charset, 0, 1))
+		return;
 	glyph_n = cffidx_cnt(chridx);
 	badcff = cffidx_cnt(chridx) - 391 > cffidx_cnt(stridx);
+	/* the charset of cid-keyed fonts contains cids instead of sids */
+	if (cffdict_get(cffidx_get(topidx, 0), cffidx_len(topidx, 0), 1236, NULL))
+		badcff = 1;
 	strcpy(glyph_name[0], ".notdef");
-	/* read font name from name index */
-	if (cffidx_cnt(nameidx) > 0) {
-		char name[256] = "";
-		memcpy(name, cffidx_get(nameidx, 0), cffidx_len(nameidx, 0));
-		if (name[0] && !otf->name[0])
-			snprintf(otf->name, sizeof(otf->name), "%s", name);
-	}
 	/* read charset: glyph to character name */
-	if (!badcff && U8(charset, 0) == 0) {
-		for (i = 0; i < glyph_n; i++)
+	if (!badcff && U8(charset, 0) == 0 && otf_in(charset, 1, 2 * (glyph_n - 1))) {
+		for (i = 0; i < glyph_n - 1; i++)
 			cff_char(stridx, U16(charset, 1 + i * 2),
 				glyph_name[i + 1]);
 	}
 	if (!badcff && (U8(charset, 0) == 1 || U8(charset, 0) == 2)) {
 		int g = 1;
 		int sz = U8(charset, 0) == 1 ? 3 : 4;
-		for (i = 0; g < glyph_n; i++) {
+		for (i = 0; g < glyph_n && otf_in(charset, 1 + i * sz, sz); i++) {
 			int sid = U16(charset, 1 + i * sz);
 			int cnt = cff_int(charset, 1 + i * sz + 2, sz - 2);
 			for (j = 0; j <= cnt && g < glyph_n; j++) {
@@ -1196,94 +3892,506 @@ static void otf_cff(struct otf *otf, void *cff)
 			}
 		}
 	}
+	cff_bbox(cff, cffidx_get(topidx, 0), cffidx_len(topidx, 0),
+		chridx, cffidx_end(stridx), NULL);
+}
+
+/* CFF2 tables have no glyph names; only glyph bounding boxes are read */
+static void otf_cff2(struct otf *otf, void *cff)
+{
+	struct ivs vs;
+	void *topdict;		/* top dict */
+	void *gsubridx;		/* global subroutines index */
+	void *chridx;		/* charstrings index */
+	int toplen;
+	int vstore;
+	if (!otf_in(cff, 0, 5) || U8(cff, 0) != 2)
+		return;
+	topdict = cff + U8(cff, 2);
+	toplen = U16(cff, 3);
+	if (!otf_in(topdict, 0, toplen))
+		return;
+	cff2 = 1;
+	gsubridx = topdict + toplen;
+	chridx = cff + cffdict_get(topdict, toplen, 17, NULL);
+	vstore = cffdict_get(topdict, toplen, 24, NULL);
+	/* blend needs the store even for the default instance */
+	memset(&vs, 0, sizeof(vs));
+	if (vstore && otf_in(cff, vstore, 2))
+		ivs_init(&vs, cff + vstore + 2);
+	if (cffidx_ok(chridx) && cffidx_ok(gsubridx) &&
+			cffidx_cnt(chridx) > 0 && cffidx_cnt(chridx) <= NGLYPHS) {
+		if (!glyph_n)
+			glyph_n = cffidx_cnt(chridx);
+		cff_bbox(cff, topdict, toplen, chridx, gsubridx, &vs);
+	}
+	ivs_done(&vs);
+	cff2 = 0;
 }
 
-static void *otf_input(int fd)
+static void *otf_input(int fd, long *len)
 {
 	struct sbuf *sb = sbuf_make();
 	char buf[1 << 12];
 	int nr = 0;
 	while ((nr = read(fd, buf, sizeof(buf))) > 0)
 		sbuf_mem(sb, buf, nr);
+	*len = sbuf_len(sb);
 	return sbuf_done(sb);
 }
 
-static void otf_feat(struct otf *otf)
+/* a kerning pair of format 0 kern subtables */
+struct kpair {
+	int c1, c2;
+	int val;
+	int idx;		/* the order of the pair in the table */
+	int over;		/* it replaces the pairs before it */
+	int dup;		/* gpos kern lookups adjust it too */
+};
+
+static int kpaircmp(void *v1, void *v2)
 {
-	if (otf_table(otf, "GSUB"))
-		otf_gsub(otf, otf_table(otf, "GSUB"));
-	if (otf_table(otf, "GPOS"))
-		otf_gpos(otf, otf_table(otf, "GPOS"));
+	struct kpair *p1 = v1;
+	struct kpair *p2 = v2;
+	if (p1->c1 != p2->c1)
+		return p1->c1 - p2->c1;
+	if (p1->c2 != p2->c2)
+		return p1->c2 - p2->c2;
+	return p1->idx - p2->idx;
+}
+
+/* sort the glyphs of a format 2 class table by class; return the number of classes */
+static int kern_classes(void *tab, long *cg, int *beg, int *val, int lo, int hi)
+{
+	int first, n, i;
+	int cnt = 0;
+	int ncls = 0;
+	if (!otf_in(tab, 0, 4) || !otf_in(tab, 4, 2 * U16(tab, 2)))
+		return 0;
+	first = U16(tab, 0);
+	n = MIN(U16(tab, 2), NGLYPHS - first);
+	for (i = 0; i < n; i++) {
+		int cls = U16(tab, 4 + 2 * i);
+		if (cls >= lo && cls < hi)
+			cg[cnt++] = ((long) cls << 16) | (first + i);
+	}
+	qsort(cg, cnt, sizeof(cg[0]), (void *) longcmp);
+	for (i = 0; i < cnt; i++) {
+		if (!i || cg[i] >> 16 != cg[i - 1] >> 16) {
+			beg[ncls] = i;
+			val[ncls++] = cg[i] >> 16;
+		}
+	}
+	beg[ncls] = cnt;
+	return ncls;
 }
 
-int otf_offsettable(void *otf_otf, void *otf_off)
+/* the glyph group of a class returned by kern_classes() */
+static int kern_group(long *cg, int *beg, int cls)
 {
+	static int g[NGLYPHS];
 	int i;
-	unsigned tag = U32(otf_off, 0);
-	struct otf otf_cur = {otf_otf, otf_off};
+	for (i = beg[cls]; i < beg[cls + 1]; i++)
+		g[i - beg[cls]] = cg[i] & 0xffff;
+	return ggrp_make(g, beg[cls + 1] - beg[cls]);
+}
+
+/* class-based kerning of kern subtable format 2, as gpos rules */
+static void otf_kern2(struct otf *otf, void *tab, int idx)
+{
+	static long lcg[NGLYPHS], rcg[NGLYPHS];
+	static int lbeg[NGLYPHS + 1], rbeg[NGLYPHS + 1];
+	static int lval[NGLYPHS], rval[NGLYPHS];
+	static int lgrp[NGLYPHS], rgrp[NGLYPHS];
+	int kmin = MAX(1, mkfn_kmin);
+	int nl, nr, wid;
+	int i, j;
+	if (!otf_in(tab, 0, 14) || mkfn_dry)
+		return;
+	wid = U16(tab, 6);
+	/* left values are row offsets; right values are column offsets */
+	nl = kern_classes(tab + U16(tab, 8), lcg, lbeg, lval, U16(tab, 12), NGLYPHS);
+	nr = kern_classes(tab + U16(tab, 10), rcg, rbeg, rval, 0, wid);
+	for (i = 0; i < nl; i++)
+		lgrp[i] = -1;
+	for (i = 0; i < nr; i++)
+		rgrp[i] = -1;
+	printf("gsec %d gpos kern:DFLT\n", idx);
+	for (i = 0; i < nl; i++) {
+		if (!otf_in(tab, lval[i], wid))
+			continue;
+		for (j = 0; j < nr; j++) {
+			int off = lval[i] + rval[j];
+			int val = otf_in(tab, off, 2) ? uwid(S16(tab, off)) : 0;
+			if (abs(val) < kmin)
+				continue;
+			/* groups are made for classes with nonzero values */
+			if (lgrp[i] < 0)
+				lgrp[i] = kern_group(lcg, lbeg, i);
+			if (rgrp[j] < 0)
+				rgrp[j] = kern_group(rcg, rbeg, j);
+			printf("2 @%d:+0+0%+d+0 @%d\n", lgrp[i], val, rgrp[j]);
+		}
+	}
+}
+
+/* the record of glyph g in a pair set of gpos pair adjustment format 1 */
+static void *kern_pairset(void *ps, int vrlen, int g)
+{
+	int n = otf_in(ps, 0, 2) ? U16(ps, 0) : 0;
+	int l = 0, h = n;
+	if (!otf_in(ps, 2, (2 + vrlen) * n))
+		return NULL;
+	while (l < h) {
+		int m = (l + h) / 2;
+		int c = U16(ps, 2 + (2 + vrlen) * m);
+		if (c == g)
+			return ps + 2 + (2 + vrlen) * m;
+		if (g < c)
+			h = m;
+		else
+			l = m + 1;
+	}
+	return NULL;
+}
+
+/*
+ * Mark the pairs to which a gpos pair adjustment subtable gives nonzero
+ * values; return zero if some of its values are not printed.
+ */
+static int kern_gpospairs(void *sub, struct kpair *pairs, int npairs)
+{
+	int fmt, vfmt1, vfmt2, vlen1, vrlen, ncov;
+	int ncls1 = 0, ncls2 = 0;
+	int vals[4];
+	int full = 1;
+	int *cov;
+	int i, k;
+	if (!otf_in(sub, 0, 10))
+		return 0;
+	uwid_init();
+	fmt = U16(sub, 0);
+	vfmt1 = U16(sub, 4);
+	vfmt2 = U16(sub, 6);
+	vlen1 = valuerecord_len(vfmt1);
+	vrlen = vlen1 + valuerecord_len(vfmt2);
+	if (fmt == 2 && otf_in(sub, 0, 16)) {
+		ncls1 = U16(sub, 12);
+		ncls2 = U16(sub, 14);
+		if (!otf_in(sub, 16, (long) ncls1 * ncls2 * vrlen))
+			ncls1 = 0;
+		/* second glyphs of class 0 are not listed */
+		for (i = 0; i < ncls1 && ncls2; i++)
+			if (valuerecord(vfmt1, sub + 16 + i * ncls2 * vrlen, sub, vals) ||
+					valuerecord(vfmt2, sub + 16 + i * ncls2 * vrlen + vlen1, sub, vals))
+				full = 0;
+	}
+	cov = coverage(sub + U16(sub, 2), &ncov);
+	if (fmt == 1 && !otf_in(sub, 10, 2 * U16(sub, 8)))
+		ncov = 0;
+	if (fmt == 1)
+		ncov = MIN(ncov, U16(sub, 8));
+	if (fmt == 2 && !ncls1)
+		ncov = 0;
+	for (i = 0; i < ncov; i++) {
+		void *ps = sub + U16(sub, 10 + 2 * i);
+		int c1 = fmt == 2 ? classdef_get(sub + U16(sub, 8), cov[i]) : 0;
+		int l = 0, h = npairs;
+		while (l < h) {
+			int m = (l + h) / 2;
+			if (pairs[m].c1 < cov[i])
+				l = m + 1;
+			else
+				h = m;
+		}
+		for (k = l; k < npairs && pairs[k].c1 == cov[i]; k++) {
+			void *par = fmt == 1 ? ps : sub;	/* the parent of device tables */
+			void *rec = NULL;			/* the values of the pair */
+			if (fmt == 1 && (rec = kern_pairset(ps, vrlen, pairs[k].c2)))
+				rec += 2;
+			/* unlisted second glyphs are not in the printed groups */
+			if (fmt == 2 && c1 < ncls1) {
+				int c2 = classdef_get(sub + U16(sub, 10), pairs[k].c2);
+				if (c2 > 0 && c2 < ncls2)
+					rec = sub + 16 + (c1 * ncls2 + c2) * vrlen;
+			}
+			if (rec && (valuerecord(vfmt1, rec, par, vals) ||
+					valuerecord(vfmt2, rec + vlen1, par, vals)))
+				pairs[k].dup = 1;
+		}
+	}
+	free(cov);
+	return full && (fmt == 1 || (fmt == 2 && ncls1));
+}
+
+/*
+ * Mark kern table pairs adjusted by the selected gpos kern lookups;
+ * return nonzero if mkfn prints one of them in full.
+ */
+static int kern_gpos(void *gpos, struct otflookup *lookups, int nlookups,
+		struct kpair *pairs, int npairs)
+{
+	void *lookuplist = gpos + U16(gpos, 8);
+	char *seen = calloc(1 << 16, 1);
+	int found = 0;
+	int i, j;
+	for (i = 0; i < nlookups; i++) {
+		void *lookup = otf_lookup(lookuplist, lookups[i].lookup);
+		int full = 1;		/* mkfn prints the lookup in full */
+		if (!lookup || strcmp("kern", lookups[i].feat))
+			continue;
+		if (seen[lookups[i].lookup]++)
+			continue;
+		for (j = 0; j < U16(lookup, 4); j++) {
+			void *tab = lookup + U16(lookup, 6 + 2 * j);
+			int type = U16(lookup, 0);
+			if (type == 9) {
+				if (!otf_in(tab, 0, 8))
+					continue;
+				type = U16(tab, 2);
+				tab = tab + U32(tab, 4);
+			}
+			if (type != 2 || !kern_gpospairs(tab, pairs, npairs))
+				full = 0;
+		}
+		if (full && U16(lookup, 4))
+			found = 1;
+	}
+	free(seen);
+	return found;
+}
+
+/*
+ * Print kern table pairs.  Pairs to which the selected gpos kern
+ * lookups give nonzero values are dropped.  Format 2 subtables are
+ * dropped too if mkfn prints a gpos kern lookup in full; shapers
+ * ignore the kern table in that case.
+ */
+static void otf_kern(struct otf *otf, void *kern, void *gpos,
+		struct otflookup *lookups, int nlookups)
+{
+	struct kpair *pairs = NULL;
+	void **cls;			/* format 2 subtables */
+	int npairs = 0;
+	int ncls = 0;
+	int off = 4;
+	int i, j;
+	int n;				/* number of kern subtables */
+	if (!otf_in(kern, 0, 4))
+		return;
+	n = U16(kern, 2);
+	cls = malloc(n * sizeof(cls[0]));
+	for (i = 0; i < n; i++) {
+		void *tab = kern + off;	/* a kern subtable */
+		int cov, cnt;
+		if (!otf_in(tab, 0, 14))
+			break;
+		cov = U16(tab, 4);
+		off += U16(tab, 2);
+		/* minimum and cross-stream values are not kerning amounts */
+		if ((cov & 7) != 1)
+			continue;
+		if ((cov >> 8) == 2)
+			cls[ncls++] = tab;
+		cnt = U16(tab, 6);
+		if ((cov >> 8) != 0 || !otf_in(tab, 14, 6 * cnt))
+			continue;
+		pairs = realloc(pairs, (npairs + cnt) * sizeof(pairs[0]));
+		for (j = 0; j < cnt; j++) {
+			struct kpair *p = &pairs[npairs];
+			p->c1 = U16(tab, 14 + 6 * j);
+			p->c2 = U16(tab, 14 + 6 * j + 2);
+			p->val = S16(tab, 14 + 6 * j + 4);
+			p->over = (cov & 8) != 0;
+			p->dup = 0;
+			p->idx = npairs++;
+		}
+	}
+	/* the values of a pair in different subtables are added */
+	if (npairs)
+		qsort(pairs, npairs, sizeof(pairs[0]), (void *) kpaircmp);
+	if (gpos && kern_gpos(gpos, lookups, nlookups, pairs, npairs))
+		ncls = 0;
+	for (i = 0; i < npairs; i = j) {
+		int val = 0;
+		int dup = 0;
+		for (j = i; j < npairs && pairs[j].c1 == pairs[i].c1 &&
+				pairs[j].c2 == pairs[i].c2; j++) {
+			val = pairs[j].over ? pairs[j].val : val + pairs[j].val;
+			dup = dup || pairs[j].dup;
+		}
+		if (!dup)
+			mkfn_kern(glyph_name[pairs[i].c1],
+				glyph_name[pairs[i].c2], uwid(val));
+	}
+	for (i = 0; i < ncls; i++)
+		otf_kern2(otf, cls[i], i);
+	free(pairs);
+	free(cls);
+}
+
+static void otf_feat(struct otf *otf)
+{
+	void *gsub = otf_table(otf, "GSUB");
+	void *gpos = otf_table(otf, "GPOS");
+	void *kern = otf_table(otf, "kern");
+	struct otflookup *sublu = NULL, *poslu = NULL;
+	int nsub = 0, npos = 0;
+	if (gsub && !otf_in(gsub, 0, 10))
+		gsub = NULL;
+	if (gpos && !otf_in(gpos, 0, 10))
+		gpos = NULL;
+	/* the lookups are selected first; the kern table depends on gpos */
+	if (gsub)
+		sublu = otf_gtab(otf, gsub, &nsub);
+	if (gpos)
+		poslu = otf_gtab(otf, gpos, &npos);
+	if (kern && !mkfn_dry)
+		otf_kern(otf, kern, gpos, poslu, npos);
+	otf_gdef(otf, otf_table(otf, "GDEF"));
+	if (gsub)
+		otf_gsub(otf, gsub, sublu, nsub);
+	if (gpos)
+		otf_gpos(otf, gpos, poslu, npos);
+}
+
+int otf_offsettable(void *otf_otf, void *otf_off, long len)
+{
+	struct otf otf_cur;
 	struct otf *otf = &otf_cur;
+	unsigned tag = U32(otf_off, 0);
+	int i, j, k = 0;
 	if (tag != 0x00010000 && tag != 0x4F54544F)
 		return 1;
+	memset(otf, 0, sizeof(*otf));
+	/* the variation state of the previous face of a collection */
+	var_n = 0;
+	ivs_done(&var_gdef);
+	otf->otf = otf_otf;
+	otf->off = otf_off;
+	otf->len = len;
+	otf_tabinit(otf);
+	if (otf_tablen(otf, "head") < 54)
+		return 1;
 	upm = U16(otf_table(otf, "head"), 18);
-	otf_name(otf, otf_table(otf, "name"));
-	otf_cmap(otf, otf_table(otf, "cmap"));
-	otf_post(otf, otf_table(otf, "post"));
+	if (!upm)
+		return 1;
+	if (otf_table(otf, "name"))
+		otf_name(otf, otf_table(otf, "name"));
+	if (otf_table(otf, "CFF "))
+		otf_cffname(otf, otf_table(otf, "CFF "));
+	if (!mkfn_font(otf->name))
+		return 0;
+	if (otf_fvar(otf, otf_table(otf, "fvar"))) {
+		fprintf(stderr, "neatmkfn: variable font instance not found\n");
+		return 1;
+	}
+	if (var_n && otf_tablen(otf, "GDEF") >= 18 &&
+			U32(otf_table(otf, "GDEF"), 0) >= 0x10003 &&
+			U32(otf_table(otf, "GDEF"), 14))
+		ivs_init(&var_gdef, otf_table(otf, "GDEF") +
+			U32(otf_table(otf, "GDEF"), 14));
+	/* listing scripts and languages needs only GSUB and GPOS */
+	if (mkfn_dry) {
+		otf_feat(otf);
+		return 0;
+	}
+	if (otf_table(otf, "cmap"))
+		otf_cmap(otf, otf_table(otf, "cmap"));
+	if (otf_table(otf, "post"))
+		otf_post(otf, otf_table(otf, "post"));
 	if (otf_table(otf, "glyf"))
 		otf_glyf(otf, otf_table(otf, "glyf"));
 	if (otf_table(otf, "CFF "))
 		otf_cff(otf, otf_table(otf, "CFF "));
+	if (otf_table(otf, "CFF2"))
+		otf_cff2(otf, otf_table(otf, "CFF2"));
 	for (i = 0; i < glyph_n; i++) {
 		if (!glyph_name[i][0]) {
-			if (glyph_code[i])
+			if (glyph_code[i] > 0xffff)
+				sprintf(glyph_name[i], "u%X", glyph_code[i]);
+			else if (glyph_code[i])
 				sprintf(glyph_name[i], "uni%04X", glyph_code[i]);
 			else
 				sprintf(glyph_name[i], "gl%05X", i);
 		}
 	}
 	otf_hmtx(otf, otf_table(otf, "hmtx"));
-	if (!mkfn_font(otf->name))
-		return 0;
 	for (i = 0; i < glyph_n; i++) {
 		mkfn_char(glyph_name[i], -1,
 			glyph_code[i] != 0xffff ? glyph_code[i] : 0,
 			uwid(glyph_wid[i]),
 			uwid(glyph_bbox[i][0]), uwid(glyph_bbox[i][1]),
 			uwid(glyph_bbox[i][2]), uwid(glyph_bbox[i][3]));
+		/* other codepoints of the glyph */
+		for (j = cmap_beg[i] + 1; i && j < cmap_beg[i + 1]; j++)
+			if (cmap_codes[j] != 0xffff)
+				mkfn_alias(cmap_codes[j], 0);
+		/* its unicode variation sequences */
+		for (; k < uvs_n && uvs[k].glyph <= i; k++)
+			if (uvs[k].glyph == i)
+				mkfn_alias(uvs[k].code, uvs[k].vs);
 	}
 	mkfn_header(otf->name);
-	if (otf_table(otf, "kern"))
-		otf_kern(otf, otf_table(otf, "kern"));
 	otf_feat(otf);
+	ivs_done(&var_gdef);
 	return 0;
 }
 
 int otf_read(void)
 {
-	char *otf_buf = otf_input(0);
-	unsigned tag = U32(otf_buf, 0);
+	long len;
+	char *otf_buf = otf_input(0, &len);
+	char *sfnt;
+	unsigned tag;
 	int n, i;
+	/* WOFF and WOFF2 fonts are decoded first */
+	if ((sfnt = woff_sfnt(otf_buf, len, &len)) != NULL) {
+		free(otf_buf);
+		otf_buf = sfnt;
+	}
+	if (len < 12)
+		return 1;
+	otf_beg = otf_buf;
+	otf_len = len;
+	tag = U32(otf_buf, 0);
 	if (tag == 0x00010000 || tag == 0x4F54544F)
-		return otf_offsettable(otf_buf, otf_buf);
+		return otf_offsettable(otf_buf, otf_buf, len);
 	if (tag != 0x74746366)
 		return 1;
 	/* OpenType Collections */
 	n = U32(otf_buf, 8);
+	if (12 + 4L * n > len)
+		n = (len - 12) / 4;
 	for (i = 0; i < n; i++) {
-		void *off = otf_buf + U32(otf_buf, 12 + i * 4);
-		otf_offsettable(otf_buf, off);
+		unsigned long off = U32(otf_buf, 12 + i * 4);
+		if (off + 12 <= len)
+			otf_offsettable(otf_buf, otf_buf + off, len);
 	}
 	return 0;
 }
 
 /* glyph groups */
-static int *ggrp_g[NGRPS];
-static int ggrp_len[NGRPS];
+static int **ggrp_g;
+static int *ggrp_len;
+static int *ggrp_next;		/* the next group in the same hash bucket */
+static int ggrp_head[NGHASH];	/* the first group in each bucket plus one */
 static int ggrp_n;
+static int ggrp_sz;
+
+static int ggrp_hash(int *src, int n)
+{
+	unsigned h = n;
+	int i;
+	for (i = 0; i < n; i++)
+		h = h * 31 + src[i];
+	return h & (NGHASH - 1);
+}
 
 static int ggrp_find(int *src, int n)
 {
 	int i, j;
-	for (i = 0; i < ggrp_n; i++) {
+	for (i = ggrp_head[ggrp_hash(src, n)] - 1; i >= 0; i = ggrp_next[i]) {
 		if (ggrp_len[i] == n) {
 			for (j = 0; j < n; j++)
 				if (src[j] != ggrp_g[i][j])
@@ -1295,15 +4403,24 @@ static int ggrp_find(int *src, int n)
 	return -1;
 }
 
-static int ggrp_make(int *src, int n)
+static int ggrp_put(int *src, int n)
 {
 	int id = ggrp_find(src, n);
+	int h = ggrp_hash(src, n);
 	int i;
 	if (id >= 0)
 		return id;
+	if (ggrp_n == ggrp_sz) {
+		ggrp_sz = ggrp_sz ? ggrp_sz * 2 : NGRPS;
+		ggrp_g = realloc(ggrp_g, ggrp_sz * sizeof(ggrp_g[0]));
+		ggrp_len = realloc(ggrp_len, ggrp_sz * sizeof(ggrp_len[0]));
+		ggrp_next = realloc(ggrp_next, ggrp_sz * sizeof(ggrp_next[0]));
+	}
 	id = ggrp_n++;
 	ggrp_g[id] = malloc(n * sizeof(ggrp_g[id][0]));
 	ggrp_len[id] = n;
+	ggrp_next[id] = ggrp_head[h] - 1;
+	ggrp_head[h] = id + 1;
 	for (i = 0; i < n; i++)
 		ggrp_g[id][i] = src[i];
 	printf("ggrp %d %d", id, n);
@@ -1313,6 +4430,104 @@ static int ggrp_make(int *src, int n)
 	return id;
 }
 
+/* glyphs ignored by the current lookup are left out of its groups */
+static int ggrp_make(int *src, int n)
+{
+	int *g = malloc((n + 1) * sizeof(g[0]));
+	int i, id, cnt = 0;
+	for (i = 0; i < n; i++)
+		if (!gdef_skip(src[i]))
+			g[cnt++] = src[i];
+	id = ggrp_put(g, cnt);
+	free(g);
+	return id;
+}
+
+/* coverage tables interned as glyph groups */
+static void **gcov_tab;		/* coverage tables */
+static long *gcov_key;		/* the lookup flags and mark set of their groups */
+static int *gcov_grp;		/* their groups */
+static int *gcov_next;		/* the next table in the same hash bucket */
+static int gcov_head[NGHASH];	/* the first table in each bucket plus one */
+static int gcov_n;
+static int gcov_sz;
+
+/* the glyph group of a coverage table; shared tables are read once */
+static int ggrp_covtab(void *tab)
+{
+	int h = ((unsigned long) tab >> 1) & (NGHASH - 1);
+	long key = gdef_flag & 0x10 ? ((long) gdef_set << 16) | gdef_flag : gdef_flag;
+	int *cov;
+	int i, ncov;
+	for (i = gcov_head[h] - 1; i >= 0; i = gcov_next[i])
+		if (gcov_tab[i] == tab && gcov_key[i] == key)
+			return gcov_grp[i];
+	if (gcov_n == gcov_sz) {
+		gcov_sz = gcov_sz ? gcov_sz * 2 : NGRPS;
+		gcov_tab = realloc(gcov_tab, gcov_sz * sizeof(gcov_tab[0]));
+		gcov_key = realloc(gcov_key, gcov_sz * sizeof(gcov_key[0]));
+		gcov_grp = realloc(gcov_grp, gcov_sz * sizeof(gcov_grp[0]));
+		gcov_next = realloc(gcov_next, gcov_sz * sizeof(gcov_next[0]));
+	}
+	cov = coverage(tab, &ncov);
+	i = gcov_n++;
+	gcov_tab[i] = tab;
+	gcov_key[i] = key;
+	gcov_grp[i] = ggrp_coverage(cov, ncov);
+	gcov_next[i] = gcov_head[h] - 1;
+	gcov_head[h] = i + 1;
+	free(cov);
+	return gcov_grp[i];
+}
+
+/* the group of the glyphs in both groups, or -1 if there is none */
+static int ggrp_meet(int id1, int id2)
+{
+	int *g1 = ggrp_g[id1], *g2 = ggrp_g[id2];
+	int n1 = ggrp_len[id1], n2 = ggrp_len[id2];
+	int *g;
+	int i = 0, j = 0, n = 0;
+	if (id1 == id2)
+		return id1;
+	g = malloc((MIN(n1, n2) + 1) * sizeof(g[0]));
+	while (i < n1 && j < n2) {
+		if (g1[i] == g2[j]) {
+			g[n++] = g1[i];
+			i++;
+			j++;
+		} else if (g1[i] < g2[j]) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	id1 = n ? ggrp_make(g, n) : -1;
+	free(g);
+	return id1;
+}
+
+/* the number of glyphs in a group */
+static int ggrp_size(int id)
+{
+	return ggrp_len[id];
+}
+
+/* check if glyph g is in the given group */
+static int ggrp_has(int id, int g)
+{
+	int l = 0, h = ggrp_len[id];
+	while (l < h) {
+		int m = (l + h) / 2;
+		if (ggrp_g[id][m] == g)
+			return 1;
+		if (ggrp_g[id][m] < g)
+			l = m + 1;
+		else
+			h = m;
+	}
+	return 0;
+}
+
 static char *macset[] = {
 	".notdef", ".null", "nonmarkingreturn", "space", "exclam",
 	"quotedbl", "numbersign", "dollar", "percent", "ampersand",
@@ -0,0 +1,602 @@
+/* Type 1 fonts (PFA and PFB) */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mkfn.h"
+
+#define U8(buf, off)		(*(unsigned char *) ((buf) + (off)))
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define MAX(a, b)		((a) < (b) ? (b) : (a))
+#define LEN(a)			((sizeof(a) / sizeof((a)[0])))
+#define NAMELEN			128
+#define NSTRS			(1 << 16)	/* maximum number of subrs or glyphs */
+
+/* standard encoding, for the font encoding and seac */
+static char *stdenc[256] = {
+	[32] = "space", "exclam", "quotedbl", "numbersign", "dollar",
+	"percent", "ampersand", "quoteright", "parenleft", "parenright",
+	"asterisk", "plus", "comma", "hyphen", "period", "slash",
+	"zero", "one", "two", "three", "four", "five", "six", "seven",
+	"eight", "nine", "colon", "semicolon", "less", "equal", "greater",
+	"question", "at", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J",
+	"K", "L", "M", "N", "O", "P", "Q", "R", "S", "T", "U", "V", "W",
+	"X", "Y", "Z", "bracketleft", "backslash", "bracketright",
+	"asciicircum", "underscore", "quoteleft", "a", "b", "c", "d", "e",
+	"f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p", "q", "r",
+	"s", "t", "u", "v", "w", "x", "y", "z", "braceleft", "bar",
+	"braceright", "asciitilde",
+	[161] = "exclamdown", "cent", "sterling", "fraction", "yen",
+	"florin", "section", "currency", "quotesingle", "quotedblleft",
+	"guillemotleft", "guilsinglleft", "guilsinglright", "fi", "fl",
+	[177] = "endash", "dagger", "daggerdbl", "periodcentered",
+	[182] = "paragraph", "bullet", "quotesinglbase", "quotedblbase",
+	"quotedblright", "guillemotright", "ellipsis", "perthousand",
+	[191] = "questiondown",
+	[193] = "grave", "acute", "circumflex", "tilde", "macron", "breve",
+	"dotaccent", "dieresis",
+	[202] = "ring", "cedilla",
+	[205] = "hungarumlaut", "ogonek", "caron", "emdash",
+	[225] = "AE",
+	[227] = "ordfeminine",
+	[232] = "Lslash", "Oslash", "OE", "ordmasculine",
+	[241] = "ae",
+	[245] = "dotlessi",
+	[248] = "lslash", "oslash", "oe", "germandbls",
+};
+
+static char *t1_enc[256];	/* font encoding */
+static char **t1_subrs;		/* subroutines */
+static int *t1_subrslen;	/* subroutine lengths */
+static int t1_nsubrs;		/* number of subroutines */
+static char **t1_cs;		/* glyph charstrings */
+static int *t1_cslen;		/* charstring lengths */
+static char (*t1_names)[NAMELEN];	/* glyph names */
+static int t1_n;		/* number of glyphs */
+static struct tab *t1_glyphs;	/* glyph name to index + 1 */
+static int t1_leniv = 4;	/* charstring random bytes */
+static double t1_scl = 1;	/* font matrix scale (to 1000 units) */
+
+/* find pat in s; return a pointer after it */
+static char *t1_find(char *s, char *e, char *pat)
+{
+	int len = strlen(pat);
+	for (; s + len <= e; s++)
+		if (s[0] == pat[0] && !memcmp(s, pat, len))
+			return s + len;
+	return NULL;
+}
+
+static char *t1_space(char *s, char *e)
+{
+	while (s < e && isspace((unsigned char) *s))
+		s++;
+	return s;
+}
+
+/* read a token: a name, a number, or a delimiter */
+static char *t1_tok(char *s, char *e, char *d, int len)
+{
+	int i = 0;
+	s = t1_space(s, e);
+	if (s < e && strchr("[]{}()<>", *s)) {
+		d[i++] = *s++;
+		d[i] = '\0';
+		return s;
+	}
+	if (s < e && *s == '/')
+		s++;
+	while (s < e && !isspace((unsigned char) *s) && !strchr("/[]{}()<>", *s)) {
+		if (i + 1 < len)
+			d[i++] = *s;
+		s++;
+	}
+	d[i] = '\0';
+	return s;
+}
+
+/* eexec and charstring decryption; the first skip bytes are dropped */
+static int t1_decrypt(char *d, char *s, int len, unsigned r, int skip)
+{
+	int n = 0;
+	int i;
+	for (i = 0; i < len; i++) {
+		unsigned c = U8(s, i);
+		if (i >= skip)
+			d[n++] = c ^ (r >> 8);
+		r = ((c + r) * 52845 + 22719) & 0xffff;
+	}
+	return n;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* read a binary string (len RD <bytes>) and decrypt it */
+static char *t1_binstr(char *s, char *e, char **str, int *len)
+{
+	char tok[NAMELEN];
+	int n;
+	s = t1_tok(s, e, tok, sizeof(tok));
+	n = atoi(tok);
+	s = t1_tok(s, e, tok, sizeof(tok));
+	if (n < 0 || s + 1 + n > e || !tok[0])
+		return NULL;
+	s++;
+	*str = malloc(n + 1);
+	if (t1_leniv >= 0)
+		*len = t1_decrypt(*str, s, n, 4330, t1_leniv);
+	else
+		memcpy(*str, s, (*len = n));
+	return s + n;
+}
+
+/* read subrs and charstrings from the private dictionary */
+static int t1_private(char *s, char *e)
+{
+	char tok[NAMELEN];
+	char *r;
+	int n, i;
+	if ((r = t1_find(s, e, "/lenIV")) != NULL) {
+		t1_tok(r, e, tok, sizeof(tok));
+		t1_leniv = atoi(tok);
+	}
+	if ((r = t1_find(s, e, "/Subrs")) != NULL) {
+		r = t1_tok(r, e, tok, sizeof(tok));
+		n = MIN(MAX(0, atoi(tok)), NSTRS);
+		t1_subrs = calloc(n + 1, sizeof(t1_subrs[0]));
+		t1_subrslen = calloc(n + 1, sizeof(t1_subrslen[0]));
+		t1_nsubrs = n;
+		r = t1_tok(r, e, tok, sizeof(tok));	/* array */
+		while (r) {
+			char *p = t1_tok(r, e, tok, sizeof(tok));
+			if (strcmp("dup", tok))
+				break;
+			p = t1_tok(p, e, tok, sizeof(tok));
+			i = atoi(tok);
+			if (i < 0 || i >= n || t1_subrs[i])
+				break;
+			if (!(p = t1_binstr(p, e, &t1_subrs[i], &t1_subrslen[i])))
+				break;
+			r = t1_tok(p, e, tok, sizeof(tok));	/* NP */
+			if (!strcmp("noaccess", tok))
+				r = t1_tok(r, e, tok, sizeof(tok));
+		}
+		s = r ? r : s;
+	}
+	if ((r = t1_find(s, e, "/CharStrings")) == NULL)
+		return 1;
+	r = t1_tok(r, e, tok, sizeof(tok));
+	n = MIN(MAX(0, atoi(tok)), NSTRS);
+	if ((r = t1_find(r, e, "begin")) == NULL)
+		return 1;
+	t1_cs = calloc(n + 1, sizeof(t1_cs[0]));
+	t1_cslen = calloc(n + 1, sizeof(t1_cslen[0]));
+	t1_names = calloc(n + 1, sizeof(t1_names[0]));
+	t1_glyphs = tab_alloc(n + 1);
+	while (t1_n < n) {
+		r = t1_space(r, e);
+		if (r >= e || *r != '/')
+			break;
+		r = t1_tok(r, e, t1_names[t1_n], sizeof(t1_names[t1_n]));
+		if (!(r = t1_binstr(r, e, &t1_cs[t1_n], &t1_cslen[t1_n])))
+			break;
+		r = t1_tok(r, e, tok, sizeof(tok));	/* ND */
+		if (!strcmp("noaccess", tok))
+			r = t1_tok(r, e, tok, sizeof(tok));
+		if (!tab_get(t1_glyphs, t1_names[t1_n]))
+			tab_put(t1_glyphs, t1_names[t1_n], (void *) (long) (t1_n + 1));
+		t1_n++;
+	}
+	return 0;
+}
+
+/* read the font name, font matrix, and encoding from the clear text */
+static void t1_clear(char *s, char *e, char *fontname)
+{
+	char tok[NAMELEN];
+	char *r;
+	int i;
+	if ((r = t1_find(s, e, "/FontName")) != NULL)
+		t1_tok(r, e, fontname, NAMELEN);
+	if ((r = t1_find(s, e, "/FontMatrix")) != NULL) {
+		r = t1_tok(r, e, tok, sizeof(tok));
+		if (tok[0] == '[' || tok[0] == '{')
+			t1_tok(r, e, tok, sizeof(tok));
+		if (atof(tok) > 0)
+			t1_scl = atof(tok) * 1000;
+	}
+	if ((r = t1_find(s, e, "/Encoding")) == NULL)
+		return;
+	r = t1_tok(r, e, tok, sizeof(tok));
+	if (!strcmp("StandardEncoding", tok)) {
+		memcpy(t1_enc, stdenc, sizeof(stdenc));
+		return;
+	}
+	/* dup code /name put ... readonly def */
+	while (r < e) {
+		r = t1_tok(r, e, tok, sizeof(tok));
+		if (!strcmp("def", tok))
+			break;
+		if (strcmp("dup", tok))
+			continue;
+		r = t1_tok(r, e, tok, sizeof(tok));
+		i = atoi(tok);
+		r = t1_space(r, e);
+		if (r >= e || *r != '/')
+			continue;
+		r = t1_tok(r, e, tok, sizeof(tok));
+		if (i >= 0 && i < 256 && !t1_enc[i])
+			t1_enc[i] = strcpy(malloc(strlen(tok) + 1), tok);
+	}
+}
+
+/* type 1 charstring interpreter */
+struct t1cs {
+	double stk[32];			/* argument stack */
+	int n;				/* number of arguments */
+	double ps[32];			/* postscript stack for othersubrs */
+	int nps;			/* number of postscript operands */
+	double fx[7], fy[7];		/* flex points */
+	double fsx, fsy;		/* flex start point */
+	int flex;			/* in flex; the number of flex points + 1 */
+	int depth;			/* subroutine nesting depth */
+	long nops;			/* number of executed operators */
+	double ox, oy;			/* glyph origin (for seac accents) */
+	double x, y;			/* current point */
+	double wid;			/* glyph advance width */
+	int haswid;			/* glyph width is set */
+	struct bbox bb;			/* glyph bounding box */
+};
+
+static void cs_line(struct t1cs *cs, double dx, double dy)
+{
+	cs->x += dx;
+	cs->y += dy;
+	bbox_line(&cs->bb, cs->x, cs->y);
+}
+
+/* a curve to absolute coordinates */
+static void cs_curveabs(struct t1cs *cs, double x1, double y1,
+		double x2, double y2, double x3, double y3)
+{
+	bbox_curve(&cs->bb, x1, y1, x2, y2, x3, y3);
+	cs->x = x3;
+	cs->y = y3;
+}
+
+static void cs_curve(struct t1cs *cs, double dx1, double dy1,
+		double dx2, double dy2, double dx3, double dy3)
+{
+	double x1 = cs->x + dx1, y1 = cs->y + dy1;
+	double x2 = x1 + dx2, y2 = y1 + dy2;
+	cs_curveabs(cs, x1, y1, x2, y2, x2 + dx3, y2 + dy3);
+}
+
+static void cs_moveto(struct t1cs *cs, double dx, double dy)
+{
+	cs->x += dx;
+	cs->y += dy;
+	/* flex points are collected by rmoveto */
+	if (cs->flex) {
+		if (cs->flex <= LEN(cs->fx)) {
+			cs->fx[cs->flex - 1] = cs->x;
+			cs->fy[cs->flex - 1] = cs->y;
+		}
+		cs->flex++;
+		return;
+	}
+	bbox_move(&cs->bb, cs->x, cs->y);
+}
+
+/* the standard othersubrs: flex and hint replacement */
+static void cs_othersubr(struct t1cs *cs, int idx, double *args, int n)
+{
+	int i;
+	cs->nps = 0;
+	if (idx == 1) {		/* start flex */
+		cs->flex = 1;
+		cs->fsx = cs->x;
+		cs->fsy = cs->y;
+		return;
+	}
+	if (idx == 0 && cs->flex) {
+		/* the first flex point is the reference point */
+		if (cs->flex == 8) {
+			cs->x = cs->fsx;
+			cs->y = cs->fsy;
+			cs_curveabs(cs, cs->fx[1], cs->fy[1], cs->fx[2], cs->fy[2],
+				cs->fx[3], cs->fy[3]);
+			cs_curveabs(cs, cs->fx[4], cs->fy[4], cs->fx[5], cs->fy[5],
+				cs->fx[6], cs->fy[6]);
+		}
+		cs->flex = 0;
+		if (n >= 3) {
+			cs->ps[cs->nps++] = args[2];
+			cs->ps[cs->nps++] = args[1];
+		}
+		return;
+	}
+	if (idx == 2)
+		return;
+	for (i = n - 1; i >= 0 && cs->nps < LEN(cs->ps); i--)
+		cs->ps[cs->nps++] = args[i];
+}
+
+static int cs_exec(struct t1cs *cs, char *str, int len);
+
+/* standard encoding accented character */
+static int cs_seac(struct t1cs *cs, double *a)
+{
+	char *base = a[3] >= 0 && a[3] < 256 ? stdenc[(int) a[3]] : NULL;
+	char *acc = a[4] >= 0 && a[4] < 256 ? stdenc[(int) a[4]] : NULL;
+	long b = base ? (long) tab_get(t1_glyphs, base) : 0;
+	long c = acc ? (long) tab_get(t1_glyphs, acc) : 0;
+	double ox = cs->ox, oy = cs->oy;
+	double sbx = cs->x - cs->ox;	/* the left sidebearing from hsbw */
+	if (!b || !c || cs->depth >= 10)
+		return 1;
+	cs->depth++;
+	cs->n = 0;
+	cs_exec(cs, t1_cs[b - 1], t1_cslen[b - 1]);
+	cs->ox = ox + sbx + a[1] - a[0];
+	cs->oy = oy + a[2];
+	cs->n = 0;
+	cs->flex = 0;
+	cs_exec(cs, t1_cs[c - 1], t1_cslen[c - 1]);
+	cs->depth--;
+	return 1;
+}
+
+/* execute a charstring; return nonzero after endchar or errors */
+static int cs_exec(struct t1cs *cs, char *str, int len)
+{
+	double *a = cs->stk;
+	int off = 0;
+	int op, idx, n;
+	while (off < len) {
+		op = U8(str, off);
+		/* operands */
+		if (op >= 32) {
+			int sz = op == 255 ? 5 : (op >= 247 ? 2 : 1);
+			double val = op - 139;
+			if (off + sz > len)
+				return 1;
+			if (op >= 247 && op <= 250)
+				val = (op - 247) * 256 + U8(str, off + 1) + 108;
+			if (op >= 251 && op <= 254)
+				val = -(op - 251) * 256 - U8(str, off + 1) - 108;
+			if (op == 255)
+				val = (int) (((unsigned long) U8(str, off + 1) << 24) |
+					(U8(str, off + 2) << 16) |
+					(U8(str, off + 3) << 8) | U8(str, off + 4));
+			if (cs->n < LEN(cs->stk))
+				a[cs->n++] = val;
+			off += sz;
+			continue;
+		}
+		off++;
+		if (++cs->nops > (1 << 18))
+			return 1;
+		switch (op) {
+		case 13:	/* hsbw */
+		case 21:	/* rmoveto */
+		case 22:	/* hmoveto */
+		case 4:		/* vmoveto */
+			if (op == 13 && cs->n >= 2) {
+				if (!cs->haswid)
+					cs->wid = a[1];
+				cs->haswid = 1;
+				cs->x = cs->ox + a[0];
+				cs->y = cs->oy;
+			}
+			if (op == 21 && cs->n >= 2)
+				cs_moveto(cs, a[0], a[1]);
+			if (op == 22 && cs->n >= 1)
+				cs_moveto(cs, a[0], 0);
+			if (op == 4 && cs->n >= 1)
+				cs_moveto(cs, 0, a[0]);
+			break;
+		case 5:		/* rlineto */
+			if (cs->n >= 2)
+				cs_line(cs, a[0], a[1]);
+			break;
+		case 6:		/* hlineto */
+			if (cs->n >= 1)
+				cs_line(cs, a[0], 0);
+			break;
+		case 7:		/* vlineto */
+			if (cs->n >= 1)
+				cs_line(cs, 0, a[0]);
+			break;
+		case 8:		/* rrcurveto */
+			if (cs->n >= 6)
+				cs_curve(cs, a[0], a[1], a[2], a[3], a[4], a[5]);
+			break;
+		case 30:	/* vhcurveto */
+			if (cs->n >= 4)
+				cs_curve(cs, 0, a[0], a[1], a[2], a[3], 0);
+			break;
+		case 31:	/* hvcurveto */
+			if (cs->n >= 4)
+				cs_curve(cs, a[0], 0, a[1], a[2], 0, a[3]);
+			break;
+		case 10:	/* callsubr */
+			if (!cs->n || cs->depth >= 10)
+				return 1;
+			if (a[cs->n - 1] < 0 || a[cs->n - 1] >= t1_nsubrs)
+				return 1;
+			idx = a[--cs->n];
+			if (!t1_subrs[idx])
+				return 1;
+			cs->depth++;
+			if (cs_exec(cs, t1_subrs[idx], t1_subrslen[idx]))
+				return 1;
+			cs->depth--;
+			continue;
+		case 11:	/* return */
+			return 0;
+		case 14:	/* endchar */
+			return 1;
+		case 12:	/* escape */
+			if (off >= len)
+				return 1;
+			op = U8(str, off++);
+			if (op == 6 && cs->n >= 5)		/* seac */
+				return cs_seac(cs, a);
+			if (op == 7 && cs->n >= 4) {		/* sbw */
+				if (!cs->haswid)
+					cs->wid = a[2];
+				cs->haswid = 1;
+				cs->x = cs->ox + a[0];
+				cs->y = cs->oy + a[1];
+			}
+			if (op == 12 && cs->n >= 2) {		/* div */
+				if (a[cs->n - 1])
+					a[cs->n - 2] /= a[cs->n - 1];
+				cs->n--;
+				continue;
+			}
+			if (op == 16 && cs->n >= 2) {		/* callothersubr */
+				if (a[cs->n - 2] < 0 || a[cs->n - 2] > cs->n - 2)
+					return 1;
+				idx = a[cs->n - 1] >= 0 && a[cs->n - 1] < 256 ? a[cs->n - 1] : 256;
+				n = a[cs->n - 2];
+				cs->n -= 2 + n;
+				cs_othersubr(cs, idx, a + cs->n, n);
+				continue;
+			}
+			if (op == 17) {				/* pop */
+				if (cs->nps && cs->n < LEN(cs->stk))
+					a[cs->n++] = cs->ps[--cs->nps];
+				continue;
+			}
+			if (op == 33 && cs->n >= 2) {		/* setcurrentpoint */
+				cs->x = cs->ox + a[0];
+				cs->y = cs->oy + a[1];
+			}
+			break;
+		}
+		cs->n = 0;
+	}
+	return 0;
+}
+
+/* read the font; pfb segments are concatenated and bin is the offset of the first binary segment */
+static char *t1_input(long *len, long *bin)
+{
+	struct sbuf *sb = sbuf_make();
+	char buf[1 << 12];
+	char *s, *d;
+	long n = 0, i;
+	while ((i = fread(buf, 1, sizeof(buf), stdin)) > 0)
+		sbuf_mem(sb, buf, i);
+	*len = sbuf_len(sb);
+	*bin = -1;
+	s = sbuf_done(sb);
+	if (*len < 6 || U8(s, 0) != 0x80)
+		return s;
+	d = malloc(*len);
+	i = 0;
+	while (i + 6 <= *len && U8(s, i) == 0x80 && U8(s, i + 1) != 3) {
+		long seg = U8(s, i + 2) | (U8(s, i + 3) << 8) |
+			(U8(s, i + 4) << 16) | ((long) U8(s, i + 5) << 24);
+		if (U8(s, i + 1) == 2 && *bin < 0)
+			*bin = n;
+		i += 6;
+		seg = MIN(MAX(0, seg), *len - i);
+		memcpy(d + n, s + i, seg);
+		n += seg;
+		i += seg;
+	}
+	free(s);
+	*len = n;
+	return d;
+}
+
+int t1_read(void)
+{
+	char fontname[NAMELEN] = "";
+	struct t1cs cs;
+	long len, bin, n = 0;
+	char *buf = t1_input(&len, &bin);
+	char *s, *priv;
+	int bbox[4];
+	int hex = 0;
+	int i, j;
+	if (!(s = t1_find(buf, buf + len, "eexec"))) {
+		free(buf);
+		return 1;
+	}
+	t1_clear(buf, s, fontname);
+	/* the encrypted portion of pfa fonts may be in hexadecimal */
+	if (bin >= 0 && buf + bin >= s) {
+		s = buf + bin;
+	} else {
+		char *r = t1_space(s, buf + len);
+		hex = buf + len - r >= 4 && hexval(r[0]) >= 0 && hexval(r[1]) >= 0 &&
+			hexval(r[2]) >= 0 && hexval(r[3]) >= 0;
+		if (hex) {
+			s = r;
+		} else {
+			s += s < buf + len && *s == '\r';
+			s += s < buf + len && *s == '\n';
+		}
+	}
+	priv = malloc(buf + len - s + 1);
+	if (hex) {
+		for (; s + 1 < buf + len; s++) {
+			if (isspace((unsigned char) *s))
+				continue;
+			if (hexval(s[0]) < 0 || hexval(s[1]) < 0)
+				break;
+			priv[n++] = hexval(s[0]) * 16 + hexval(s[1]);
+			s++;
+		}
+	} else {
+		memcpy(priv, s, buf + len - s);
+		n = buf + len - s;
+	}
+	n = t1_decrypt(priv, priv, n, 55665, 4);
+	if (t1_private(priv, priv + n)) {
+		free(priv);
+		free(buf);
+		return 1;
+	}
+	for (i = 0; i < t1_n; i++) {
+		int pos = -1;
+		memset(&cs, 0, sizeof(cs));
+		cs_exec(&cs, t1_cs[i], t1_cslen[i]);
+		for (j = 0; j < 256 && pos < 0; j++)
+			if (t1_enc[j] && !strcmp(t1_enc[j], t1_names[i]))
+				pos = j;
+		bbox_get(&cs.bb, t1_scl, bbox);
+		mkfn_char(t1_names[i], pos, 0,
+			mkfn_uwid(mkfn_ifloor(cs.wid * t1_scl + 0.5)),
+			mkfn_uwid(bbox[0]), mkfn_uwid(bbox[1]),
+			mkfn_uwid(bbox[2]), mkfn_uwid(bbox[3]));
+	}
+	mkfn_header(fontname);
+	for (i = 0; i < t1_nsubrs; i++)
+		free(t1_subrs[i]);
+	for (i = 0; i < t1_n; i++)
+		free(t1_cs[i]);
+	for (i = 0; i < 256; i++)
+		if (t1_enc[i] && t1_enc[i] != stdenc[i])
+			free(t1_enc[i]);
+	free(t1_subrs);
+	free(t1_subrslen);
+	free(t1_cs);
+	free(t1_cslen);
+	free(t1_names);
+	if (t1_glyphs)
+		tab_free(t1_glyphs);
+	free(priv);
+	free(buf);
+	return 0;
+}
@@ -284,6 +284,20 @@ void mkfn_char(char *psname, int n, int u, int wid,
 		sbuf_printf(sbuf_char, "char %s\t\"\n", *a_tr++);
 }
 
+/* u is another codepoint of the last character; vs is its variation selector */
+void mkfn_alias(int u, int vs)
+{
+	char uc[GNLEN];
+	char *s = uc;
+	utf8put(&s, u);
+	if (vs)
+		utf8put(&s, vs);
+	trfn_aglexceptions(uc);
+	if (isspace((unsigned char) uc[0]) || strchr(uc, ' '))
+		return;
+	sbuf_printf(sbuf_char, "char %s\t\"\n", uc);
+}
+
 void mkfn_kern(char *c1, char *c2, int x)
 {
 	if (x && abs(x) >= mkfn_kmin)
@@ -0,0 +1,680 @@
+/* WOFF and WOFF2 Fonts */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ZLIB
+#include <zlib.h>
+#endif
+#ifdef BROTLI
+#include <brotli/decode.h>
+#endif
+#include "mkfn.h"
+
+#define U8(buf, off)		(*(unsigned char *) ((buf) + (off)))
+#define U16(buf, off)		((U8(buf, off) << 8) | U8(buf, (off) + 1))
+#define U32(buf, off)		(((unsigned long) U16(buf, off) << 16) | U16(buf, (off) + 2))
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define ALIGN(n)		(((n) + 3) & ~3L)
+#define MAXLEN			(1L << 28)	/* maximum table length */
+
+/* the tables of a font */
+struct wtab {
+	unsigned long tag;
+	unsigned long cksum;	/* table checksum */
+	int xform;		/* transformed table */
+	char *src;		/* compressed or transformed data */
+	long srclen;		/* the length of src */
+	long len;		/* the length of the decoded table */
+	long off;		/* the offset of the decoded table */
+	int done;		/* decoded; fonts of collections share tables */
+};
+
+static void put16(char *d, long off, int v)
+{
+	d[off] = (v >> 8) & 0xff;
+	d[off + 1] = v & 0xff;
+}
+
+static void put32(char *d, long off, unsigned long v)
+{
+	put16(d, off, (v >> 16) & 0xffff);
+	put16(d, off + 2, v & 0xffff);
+}
+
+/* write an sfnt table directory of n tables, in the given order */
+static void sfnt_dir(char *d, unsigned long flavor, struct wtab *tabs, int *idx, int n)
+{
+	int sel = 0;
+	int i;
+	while ((2 << sel) <= n)
+		sel++;
+	put32(d, 0, flavor);
+	put16(d, 4, n);
+	put16(d, 6, 16 << sel);
+	put16(d, 8, sel);
+	put16(d, 10, n * 16 - (16 << sel));
+	for (i = 0; i < n; i++) {
+		struct wtab *t = &tabs[idx ? idx[i] : i];
+		put32(d, 12 + 16 * i, t->tag);
+		put32(d, 12 + 16 * i + 4, t->cksum);
+		put32(d, 12 + 16 * i + 8, t->off);
+		put32(d, 12 + 16 * i + 12, t->len);
+	}
+}
+
+/* decompress zlib data of the given length; return nonzero on failure */
+static int woff_inflate(char *d, long len, char *s, long slen)
+{
+#ifdef ZLIB
+	uLongf dlen = len;
+	return uncompress((void *) d, &dlen, (void *) s, slen) != Z_OK ||
+		dlen != len;
+#else
+	fprintf(stderr, "neatmkfn: WOFF decompression requires zlib\n");
+	return 1;
+#endif
+}
+
+/* decompress brotli data; len is the size of d and is updated */
+static int woff_brotli(char *d, size_t *len, char *s, long slen)
+{
+#ifdef BROTLI
+	return BrotliDecoderDecompress(slen, (void *) s, len, (void *) d) !=
+		BROTLI_DECODER_RESULT_SUCCESS;
+#else
+	fprintf(stderr, "neatmkfn: WOFF2 decompression requires brotli\n");
+	return 1;
+#endif
+}
+
+/* decode a WOFF file */
+static char *woff1(char *woff, long len, long *sfntlen)
+{
+	struct wtab *tabs;
+	char *sfnt;
+	long off;
+	int n, i;
+	if (len < 44)
+		return NULL;
+	n = U16(woff, 12);
+	if (44 + 20L * n > len)
+		return NULL;
+	tabs = malloc((n + 1) * sizeof(tabs[0]));
+	off = ALIGN(12 + 16L * n);
+	for (i = 0; i < n; i++) {
+		char *rec = woff + 44 + 20 * i;
+		unsigned long beg = U32(rec, 4);
+		tabs[i].tag = U32(rec, 0);
+		tabs[i].src = woff + beg;
+		tabs[i].srclen = U32(rec, 8);
+		tabs[i].len = U32(rec, 12);
+		tabs[i].cksum = U32(rec, 16);
+		tabs[i].off = off;
+		if (beg > len || tabs[i].srclen > len - beg ||
+				tabs[i].len > MAXLEN || tabs[i].srclen > tabs[i].len) {
+			free(tabs);
+			return NULL;
+		}
+		off += ALIGN(tabs[i].len);
+	}
+	/* the output buffer is sized from the table directory */
+	sfnt = off <= MAXLEN ? calloc(off, 1) : NULL;
+	if (!sfnt) {
+		free(tabs);
+		return NULL;
+	}
+	sfnt_dir(sfnt, U32(woff, 4), tabs, NULL, n);
+	for (i = 0; i < n; i++) {
+		if (tabs[i].srclen == tabs[i].len) {
+			memcpy(sfnt + tabs[i].off, tabs[i].src, tabs[i].len);
+			continue;
+		}
+		if (woff_inflate(sfnt + tabs[i].off, tabs[i].len,
+				tabs[i].src, tabs[i].srclen)) {
+			free(sfnt);
+			free(tabs);
+			return NULL;
+		}
+	}
+	free(tabs);
+	*sfntlen = off;
+	return sfnt;
+}
+
+/* woff2 known table tags */
+static char *w2_tags[] = {
+	"cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post",
+	"cvt ", "fpgm", "glyf", "loca", "prep", "CFF ", "VORG", "EBDT",
+	"EBLC", "gasp", "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea",
+	"vmtx", "BASE", "GDEF", "GPOS", "GSUB", "EBSC", "JSTF", "MATH",
+	"CBDT", "CBLC", "COLR", "CPAL", "SVG ", "sbix", "acnt", "avar",
+	"bdat", "bloc", "bsln", "cvar", "fdsc", "feat", "fmtx", "fvar",
+	"gvar", "hsty", "just", "lcar", "mort", "morx", "opbd", "prop",
+	"trak", "Zapf", "Silf", "Glat", "Gloc", "Feat", "Sill",
+};
+
+#define TAG(s)		(((unsigned long) (s)[0] << 24) | ((s)[1] << 16) | ((s)[2] << 8) | (s)[3])
+
+/* woff2 input stream */
+struct wbuf {
+	char *s;		/* the current position */
+	char *e;		/* the end of the stream */
+	int err;		/* reading past the end */
+};
+
+static void wbuf_init(struct wbuf *b, char *s, long len)
+{
+	b->s = s;
+	b->e = s + len;
+	b->err = 0;
+}
+
+static char *wbuf_get(struct wbuf *b, long n)
+{
+	char *s = b->s;
+	if (n < 0 || n > b->e - b->s) {
+		b->err = 1;
+		b->s = b->e;
+		return NULL;
+	}
+	b->s += n;
+	return s;
+}
+
+static int w2_u8(struct wbuf *b)
+{
+	char *s = wbuf_get(b, 1);
+	return s ? U8(s, 0) : 0;
+}
+
+static int w2_u16(struct wbuf *b)
+{
+	char *s = wbuf_get(b, 2);
+	return s ? U16(s, 0) : 0;
+}
+
+static unsigned long w2_u32(struct wbuf *b)
+{
+	char *s = wbuf_get(b, 4);
+	return s ? U32(s, 0) : 0;
+}
+
+/* read a UIntBase128 value */
+static unsigned long w2_base128(struct wbuf *b)
+{
+	unsigned long val = 0;
+	int i, c;
+	for (i = 0; i < 5; i++) {
+		c = w2_u8(b);
+		if ((i == 0 && c == 0x80) || (val >> 25))
+			break;
+		val = (val << 7) | (c & 0x7f);
+		if (!(c & 0x80))
+			return val;
+	}
+	b->err = 1;
+	return 0;
+}
+
+/* read a 255UInt16 value */
+static int w2_255u16(struct wbuf *b)
+{
+	int c = w2_u8(b);
+	if (c == 253)
+		return w2_u16(b);
+	if (c == 255)
+		return 253 + w2_u8(b);
+	if (c == 254)
+		return 253 * 2 + w2_u8(b);
+	return c;
+}
+
+/* the glyph point encoding of woff2 glyf tables */
+static int w2_point(struct wbuf *b, int flag, int *dx, int *dy)
+{
+	int f = flag & 0x7f;
+	int sz = f < 84 ? 1 : (f < 120 ? 2 : (f < 124 ? 3 : 4));
+	char *s = wbuf_get(b, sz);
+	int x, y;
+	if (!s)
+		return 1;
+	if (f < 10) {
+		x = 0;
+		y = ((f & 14) << 7) + U8(s, 0);
+	} else if (f < 20) {
+		x = (((f - 10) & 14) << 7) + U8(s, 0);
+		y = 0;
+	} else if (f < 84) {
+		x = 1 + ((f - 20) & 0x30) + (U8(s, 0) >> 4);
+		y = 1 + (((f - 20) & 0x0c) << 2) + (U8(s, 0) & 0x0f);
+	} else if (f < 120) {
+		x = 1 + (((f - 84) / 12) << 8) + U8(s, 0);
+		y = 1 + ((((f - 84) % 12) >> 2) << 8) + U8(s, 1);
+	} else if (f < 124) {
+		x = (U8(s, 0) << 4) + (U8(s, 1) >> 4);
+		y = ((U8(s, 1) & 0x0f) << 8) + U8(s, 2);
+	} else {
+		x = U16(s, 0);
+		y = U16(s, 2);
+	}
+	*dx = f & 1 ? x : -x;
+	*dy = (f < 10 ? f : f >> 1) & 1 ? y : -y;
+	return 0;
+}
+
+/* the streams of a transformed glyf table */
+struct w2glyf {
+	struct wbuf nc;		/* number of contours */
+	struct wbuf np;		/* number of points */
+	struct wbuf fl;		/* point flags */
+	struct wbuf gl;		/* glyph data */
+	struct wbuf cm;		/* composite glyphs */
+	struct wbuf bb;		/* bounding boxes */
+	struct wbuf in;		/* instructions */
+	char *bbmap;		/* bounding box bitmap */
+	char *ovmap;		/* overlapping contours bitmap */
+	int ng;			/* number of glyphs */
+	int locafmt;		/* loca index format */
+	long bound;		/* an upper bound of glyf length */
+};
+
+/* read the header of a transformed glyf table */
+static int w2glyf_init(struct w2glyf *g, char *src, long len)
+{
+	struct wbuf b;
+	struct wbuf *s[] = {&g->nc, &g->np, &g->fl, &g->gl, &g->cm, &g->bb, &g->in};
+	long sz[7];
+	int opt, i;
+	memset(g, 0, sizeof(*g));
+	wbuf_init(&b, src, len);
+	w2_u16(&b);
+	opt = w2_u16(&b);
+	g->ng = w2_u16(&b);
+	g->locafmt = w2_u16(&b);
+	for (i = 0; i < 7; i++)
+		sz[i] = w2_u32(&b);
+	for (i = 0; i < 7; i++) {
+		char *d = sz[i] <= MAXLEN ? wbuf_get(&b, sz[i]) : NULL;
+		if (!d)
+			return 1;
+		wbuf_init(s[i], d, sz[i]);
+	}
+	g->bbmap = wbuf_get(&g->bb, ((g->ng + 31) >> 5) << 2);
+	if (opt & 1)
+		g->ovmap = wbuf_get(&b, (g->ng + 7) >> 3);
+	if (b.err || !g->bbmap)
+		return 1;
+	/* per glyph: header, instruction length, and padding */
+	g->bound = 15L * g->ng + 2 * sz[1] + 5 * sz[2] + sz[4] + sz[6];
+	return 0;
+}
+
+/* write a simple glyph; return its length */
+static long w2_simple(struct w2glyf *g, int gid, int nc, char *d,
+		int *x, int *y, int *bbox)
+{
+	char *fl;
+	char *ins;
+	long off;
+	int np = 0, ilen;
+	int cx = 0, cy = 0, dx, dy;
+	int i;
+	if (nc > g->np.e - g->np.s)
+		return -1;
+	for (i = 0; i < nc; i++) {
+		np += w2_255u16(&g->np);
+		put16(d, 10 + 2 * i, np - 1);
+	}
+	fl = wbuf_get(&g->fl, np);
+	if (!fl || np > 0xffff || g->np.err)
+		return -1;
+	for (i = 0; i < np; i++) {
+		if (w2_point(&g->gl, U8(fl, i), &dx, &dy))
+			return -1;
+		x[i] = cx += dx;
+		y[i] = cy += dy;
+	}
+	ilen = w2_255u16(&g->gl);
+	ins = wbuf_get(&g->in, ilen);
+	if (!ins || g->gl.err)
+		return -1;
+	if (!(U8(g->bbmap, gid >> 3) & (0x80 >> (gid & 7)))) {
+		for (i = 0; i < np; i++) {
+			bbox[0] = !i || x[i] < bbox[0] ? x[i] : bbox[0];
+			bbox[1] = !i || y[i] < bbox[1] ? y[i] : bbox[1];
+			bbox[2] = !i || x[i] > bbox[2] ? x[i] : bbox[2];
+			bbox[3] = !i || y[i] > bbox[3] ? y[i] : bbox[3];
+		}
+	}
+	off = 10 + 2 * nc;
+	put16(d, off, ilen);
+	memcpy(d + off + 2, ins, ilen);
+	off += 2 + ilen;
+	/* flags, then the x and y coordinates as bytes or words */
+	for (i = 0; i < np; i++) {
+		int f = U8(fl, i) & 0x80 ? 0 : 1;
+		dx = x[i] - (i ? x[i - 1] : 0);
+		dy = y[i] - (i ? y[i - 1] : 0);
+		f |= !dx ? 0x10 : (dx > -256 && dx < 256 ? (dx > 0 ? 0x12 : 0x02) : 0);
+		f |= !dy ? 0x20 : (dy > -256 && dy < 256 ? (dy > 0 ? 0x24 : 0x04) : 0);
+		if (!i && g->ovmap && (U8(g->ovmap, gid >> 3) & (0x80 >> (gid & 7))))
+			f |= 0x40;
+		d[off++] = f;
+	}
+	for (i = 0; i < np; i++) {
+		dx = x[i] - (i ? x[i - 1] : 0);
+		if (dx && dx > -256 && dx < 256)
+			d[off++] = dx < 0 ? -dx : dx;
+		if (dx <= -256 || dx >= 256) {
+			put16(d, off, dx);
+			off += 2;
+		}
+	}
+	for (i = 0; i < np; i++) {
+		dy = y[i] - (i ? y[i - 1] : 0);
+		if (dy && dy > -256 && dy < 256)
+			d[off++] = dy < 0 ? -dy : dy;
+		if (dy <= -256 || dy >= 256) {
+			put16(d, off, dy);
+			off += 2;
+		}
+	}
+	return off;
+}
+
+/* write a composite glyph; return its length */
+static long w2_composite(struct w2glyf *g, char *d)
+{
+	char *beg = g->cm.s;
+	char *ins;
+	long len;
+	int fl, ilen, instr = 0;
+	do {
+		fl = w2_u16(&g->cm);
+		instr |= fl & 0x100;
+		wbuf_get(&g->cm, 2 + (fl & 1 ? 4 : 2) +
+			(fl & 8 ? 2 : (fl & 0x40 ? 4 : (fl & 0x80 ? 8 : 0))));
+	} while ((fl & 0x20) && !g->cm.err);
+	if (g->cm.err)
+		return -1;
+	len = g->cm.s - beg;
+	memcpy(d + 10, beg, len);
+	len += 10;
+	if (instr) {
+		ilen = w2_255u16(&g->gl);
+		ins = wbuf_get(&g->in, ilen);
+		if (!ins || g->gl.err)
+			return -1;
+		put16(d, len, ilen);
+		memcpy(d + len + 2, ins, ilen);
+		len += 2 + ilen;
+	}
+	return len;
+}
+
+/* reconstruct glyf and loca tables; return nonzero on errors */
+static int w2_glyf(struct w2glyf *g, char *glyf, long *glen,
+		char *loca, long *llen, int *xmin)
+{
+	long off = 0;
+	int *x, *y;
+	int err = 0;
+	int i, j;
+	x = malloc((g->fl.e - g->fl.s + 1) * sizeof(x[0]));
+	y = malloc((g->fl.e - g->fl.s + 1) * sizeof(y[0]));
+	for (i = 0; i < g->ng && !err; i++) {
+		int nc = (short) w2_u16(&g->nc);
+		int hasbb = U8(g->bbmap, i >> 3) & (0x80 >> (i & 7));
+		int bbox[4] = {0};
+		long len = 0;
+		if (g->locafmt)
+			put32(loca, 4 * i, off);
+		else
+			put16(loca, 2 * i, off / 2);
+		xmin[i] = 0;
+		if (nc == 0 && !hasbb)
+			continue;
+		if (nc == 0 || (nc < 0 && !hasbb)) {
+			err = 1;
+			break;
+		}
+		if (nc > 0)
+			len = w2_simple(g, i, nc, glyf + off, x, y, bbox);
+		else
+			len = w2_composite(g, glyf + off);
+		for (j = 0; hasbb && j < 4; j++)
+			bbox[j] = (short) w2_u16(&g->bb);
+		if (len < 0 || g->nc.err || g->bb.err) {
+			err = 1;
+			break;
+		}
+		put16(glyf + off, 0, nc);
+		for (j = 0; j < 4; j++)
+			put16(glyf + off, 2 + 2 * j, bbox[j]);
+		xmin[i] = bbox[0];
+		off += ALIGN(len);
+	}
+	if (g->locafmt)
+		put32(loca, 4 * g->ng, off);
+	else
+		put16(loca, 2 * g->ng, off / 2);
+	*glen = off;
+	*llen = (g->ng + 1) * (g->locafmt ? 4 : 2);
+	free(x);
+	free(y);
+	return err;
+}
+
+/* reconstruct a transformed hmtx table */
+static int w2_hmtx(char *src, long srclen, char *d, long len,
+		int ng, int nhm, int *xmin)
+{
+	struct wbuf b;
+	int fl, i;
+	wbuf_init(&b, src, srclen);
+	fl = w2_u8(&b);
+	if (nhm < 1 || nhm > ng || 4L * nhm + 2L * (ng - nhm) > len)
+		return 1;
+	for (i = 0; i < nhm; i++)
+		put16(d, 4 * i, w2_u16(&b));
+	for (i = 0; i < nhm; i++)
+		put16(d, 4 * i + 2, fl & 1 ? xmin[i] : w2_u16(&b));
+	for (i = nhm; i < ng; i++)
+		put16(d, 4 * nhm + 2 * (i - nhm), fl & 2 ? xmin[i] : w2_u16(&b));
+	return b.err;
+}
+
+/* the fonts of a woff2 file */
+struct w2font {
+	unsigned long flavor;
+	int *idx;		/* table indices */
+	int n;			/* number of tables */
+};
+
+static int w2_find(struct wtab *tabs, struct w2font *font, char *tag)
+{
+	int i;
+	for (i = 0; i < font->n; i++)
+		if (tabs[font->idx[i]].tag == TAG(tag))
+			return font->idx[i];
+	return -1;
+}
+
+/* decode the tables of a font */
+static int w2_tables(struct wtab *tabs, struct w2font *font, char *sfnt)
+{
+	struct w2glyf g;
+	int glyf = w2_find(tabs, font, "glyf");
+	int loca = w2_find(tabs, font, "loca");
+	int hmtx = w2_find(tabs, font, "hmtx");
+	int hhea = w2_find(tabs, font, "hhea");
+	int *xmin = NULL;
+	int ng = 0;
+	int err = 0;
+	int i;
+	/* shared glyf tables are decoded again only for unshared hmtx tables */
+	if (glyf >= 0 && tabs[glyf].xform && (!tabs[glyf].done ||
+			(hmtx >= 0 && tabs[hmtx].xform && !tabs[hmtx].done))) {
+		/* the space for loca is reserved in woff2() */
+		if (loca < 0 || !tabs[loca].xform ||
+				w2glyf_init(&g, tabs[glyf].src, tabs[glyf].srclen) ||
+				(!tabs[loca].done && tabs[loca].len < (g.ng + 1) * 4))
+			return 1;
+		ng = g.ng;
+		xmin = malloc((ng + 1) * sizeof(xmin[0]));
+		err = w2_glyf(&g, sfnt + tabs[glyf].off, &tabs[glyf].len,
+			sfnt + tabs[loca].off, &tabs[loca].len, xmin);
+		tabs[glyf].done = 1;
+		tabs[loca].done = 1;
+	}
+	for (i = 0; i < font->n && !err; i++) {
+		struct wtab *t = &tabs[font->idx[i]];
+		if (font->idx[i] == glyf || font->idx[i] == loca || t->done)
+			continue;
+		t->done = 1;
+		if (!t->xform) {
+			memcpy(sfnt + t->off, t->src, t->len);
+			continue;
+		}
+		/* only hmtx tables of transformed glyf tables are transformed */
+		if (font->idx[i] != hmtx || !xmin || hhea < 0 || tabs[hhea].len < 36) {
+			err = 1;
+			break;
+		}
+		err = w2_hmtx(t->src, t->srclen, sfnt + t->off, t->len,
+			ng, U16(tabs[hhea].src, 34), xmin);
+	}
+	free(xmin);
+	return err;
+}
+
+/* decode a WOFF2 file */
+static char *woff2(char *woff, long len, long *sfntlen)
+{
+	struct wtab *tabs;
+	struct w2font *fonts;
+	struct wbuf b;
+	char *data = NULL, *sfnt = NULL;
+	size_t dlen = 0;
+	long off, beg;
+	int n, nfonts = 1;
+	int ttc;
+	int i, j;
+	if (len < 48)
+		return NULL;
+	ttc = U32(woff, 4) == TAG("ttcf");
+	n = U16(woff, 12);
+	tabs = calloc(n + 1, sizeof(tabs[0]));
+	wbuf_init(&b, woff + 48, len - 48);
+	for (i = 0; i < n; i++) {
+		int fl = w2_u8(&b);
+		int ver = fl >> 6;
+		tabs[i].tag = (fl & 63) == 63 ? w2_u32(&b) : TAG(w2_tags[MIN(fl & 63, 62)]);
+		tabs[i].len = w2_base128(&b);
+		if (tabs[i].tag == TAG("glyf") || tabs[i].tag == TAG("loca"))
+			tabs[i].xform = ver == 0;
+		else
+			tabs[i].xform = ver != 0;
+		tabs[i].srclen = tabs[i].xform ? w2_base128(&b) : tabs[i].len;
+		if (tabs[i].len > MAXLEN || tabs[i].srclen > MAXLEN)
+			b.err = 1;
+		dlen += tabs[i].srclen;
+	}
+	/* font collections list the tables of each font */
+	if (ttc) {
+		w2_u32(&b);
+		nfonts = w2_255u16(&b);
+	}
+	fonts = calloc(nfonts + 1, sizeof(fonts[0]));
+	for (i = 0; i < nfonts && !b.err; i++) {
+		fonts[i].n = ttc ? w2_255u16(&b) : n;
+		fonts[i].flavor = ttc ? w2_u32(&b) : U32(woff, 4);
+		fonts[i].idx = malloc((fonts[i].n + 1) * sizeof(fonts[i].idx[0]));
+		for (j = 0; j < fonts[i].n; j++) {
+			fonts[i].idx[j] = ttc ? w2_255u16(&b) : j;
+			if (fonts[i].idx[j] >= n)
+				b.err = 1;
+		}
+	}
+	/* brotli-compressed table data */
+	if (!b.err && dlen <= MAXLEN && U32(woff, 20) <= b.e - b.s) {
+		data = malloc(dlen + 1);
+		if (woff_brotli(data, &dlen, b.s, U32(woff, 20)))
+			b.err = 1;
+	} else {
+		b.err = 1;
+	}
+	/* the location of tables in the stream and in the output */
+	off = ttc ? 12 + 4L * nfonts : 0;
+	for (i = 0; i < nfonts; i++)
+		off += 12 + 16L * fonts[i].n;
+	off = ALIGN(off);
+	beg = 0;
+	for (i = 0; i < n && !b.err; i++) {
+		tabs[i].src = data + beg;
+		beg += tabs[i].srclen;
+		if (beg > (long) dlen)
+			b.err = 1;
+	}
+	/* transformed glyf and loca tables are reserved enough space */
+	for (i = 0; i < nfonts && !b.err; i++) {
+		struct w2glyf g;
+		int glyf = w2_find(tabs, &fonts[i], "glyf");
+		int loca = w2_find(tabs, &fonts[i], "loca");
+		if (glyf < 0 || !tabs[glyf].xform)
+			continue;
+		if (loca < 0 || w2glyf_init(&g, tabs[glyf].src, tabs[glyf].srclen)) {
+			b.err = 1;
+			break;
+		}
+		tabs[glyf].len = g.bound;
+		tabs[loca].len = (g.ng + 1) * 4;
+	}
+	for (i = 0; i < n && !b.err; i++) {
+		tabs[i].off = off;
+		off += ALIGN(tabs[i].len);
+		if (off > MAXLEN)
+			b.err = 1;
+	}
+	/* the output buffer is sized from the table directory */
+	if (!b.err) {
+		sfnt = calloc(off, 1);
+		for (i = 0; i < nfonts && sfnt; i++) {
+			if (w2_tables(tabs, &fonts[i], sfnt)) {
+				free(sfnt);
+				sfnt = NULL;
+			}
+		}
+	}
+	if (sfnt && ttc) {
+		put32(sfnt, 0, TAG("ttcf"));
+		put32(sfnt, 4, 0x00010000);
+		put32(sfnt, 8, nfonts);
+		beg = 12 + 4L * nfonts;
+		for (i = 0; i < nfonts; i++) {
+			put32(sfnt, 12 + 4 * i, beg);
+			sfnt_dir(sfnt + beg, fonts[i].flavor, tabs, fonts[i].idx, fonts[i].n);
+			beg += 12 + 16L * fonts[i].n;
+		}
+	} else if (sfnt) {
+		sfnt_dir(sfnt, fonts[0].flavor, tabs, fonts[0].idx, fonts[0].n);
+	}
+	for (i = 0; i < nfonts; i++)
+		free(fonts[i].idx);
+	free(fonts);
+	free(tabs);
+	free(data);
+	if (sfnt)
+		*sfntlen = off;
+	return sfnt;
+}
+
+/* convert WOFF and WOFF2 fonts to sfnt; return NULL for other inputs */
+char *woff_sfnt(char *woff, long len, long *sfntlen)
+{
+	if (len >= 4 && U32(woff, 0) == TAG("wOFF"))
+		return woff1(woff, len, sfntlen);
+	if (len >= 4 && U32(woff, 0) == TAG("wOF2"))
+		return woff2(woff, len, sfntlen);
+	return NULL;
+}